@@ -0,0 +1,255 @@
+#include "BridgeEmulator.h"
+#include <chrono>
+#include <string.h>
+
+BridgeEmulator::BridgeEmulator(Bus bus, uint32_t baud) : bus(bus), baud(baud) {
+}
+
+void BridgeEmulator::poll() {
+    if (revertBaud == 0 || std::chrono::steady_clock::now() < revertDeadline) return;
+    
+    baud = revertBaud;
+    revertBaud = 0;
+    pending.clear(); //Whatever came in was at the wrong rate
+    if (bus.setBaud) bus.setBaud(baud);
+}
+
+void BridgeEmulator::feed(const uint8_t* data, size_t nBytes, std::vector<uint8_t>& reply) {
+    poll();
+    pending.insert(pending.end(), data, data + nBytes);
+
+    size_t used = 0;
+    while (pending.size() - used >= 4) {
+        const uint8_t* packet = pending.data() + used;
+
+        //Look for the start marker and a good length checksum
+        if (packet[0] != 0x00 || packet[1] != 0xff || (uint8_t)(packet[2] + packet[3]) != 0 || packet[2] < 3) {
+            used++;
+            continue;
+        }
+
+        uint8_t length = packet[2];
+        if (pending.size() - used < (size_t)length + 4) break; //Wait for the rest
+
+        revertBaud = 0; //The new rate works (if it's a rate change, handleControl starts a new trial)
+        handlePacket(packet + 4, length, reply);
+        used += length + 4;
+    }
+
+    pending.erase(pending.begin(), pending.begin() + used);
+}
+
+void BridgeEmulator::handlePacket(const uint8_t* packet, uint8_t length, std::vector<uint8_t>& reply) {
+    uint8_t nBytes = packet[0];
+    uint8_t address = packet[1];
+    uint8_t rw = packet[2];
+    const uint8_t* data = packet + 3;
+
+    if (address == 0x00) {
+        if (length != nBytes + 3) {
+            reply.push_back(INTERFACE_NACK);
+            return;
+        }
+        handleControl(rw, data, nBytes, reply);
+        return;
+    }
+
+    if (rw == 0x00 && length == nBytes + 3) {
+        reply.push_back(bus.write && bus.write(address, data, nBytes) ? INTERFACE_ACK : INTERFACE_NACK);
+    } else if (rw == 0x01 && length == 3) {
+        uint8_t received[0x100];
+        if (!bus.read || !bus.read(address, received, nBytes)) {
+            reply.push_back(INTERFACE_NACK);
+            return;
+        }
+        reply.push_back(INTERFACE_ACK);
+        reply.insert(reply.end(), received, received + nBytes);
+    } else {
+        reply.push_back(INTERFACE_NACK);
+    }
+}
+
+void BridgeEmulator::handleControl(uint8_t control, const uint8_t* data, uint8_t nBytes, std::vector<uint8_t>& reply) {
+    switch (control) {
+        case INTERFACE_SET_BAUD: {
+            if (nBytes != 4) break;
+            uint32_t newBaud = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+            reply.push_back(INTERFACE_ACK);
+            
+            revertBaud = baud;
+            revertDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(INTERFACE_BAUD_REVERT_MS);
+            baud = newBaud;
+            if (bus.setBaud) bus.setBaud(baud);
+            return;
+        }
+        case INTERFACE_ECHO:
+            reply.push_back(INTERFACE_ACK);
+            reply.insert(reply.end(), data, data + nBytes);
+            return;
+        case INTERFACE_BATCH:
+            runBatch(data, nBytes, reply);
+            return;
+        case INTERFACE_CAPABILITIES:
+            reply.push_back(INTERFACE_ACK);
+            reply.push_back(CAPABILITIES);
+            return;
+    }
+
+    reply.push_back(INTERFACE_NACK);
+}
+
+void BridgeEmulator::runBatch(const uint8_t* ops, uint8_t nBytes, std::vector<uint8_t>& reply) {
+    std::vector<uint8_t> results;
+    uint8_t status = INTERFACE_BATCH_OK;
+    uint8_t index = 0;
+    uint16_t i = 0;
+
+    while (i < nBytes) {
+        uint8_t op = ops[i];
+
+        if (op == INTERFACE_OP_WRITE && i + 3 <= nBytes && i + 3 + ops[i + 2] <= nBytes) {
+            if (!bus.write || !bus.write(ops[i + 1], ops + i + 3, ops[i + 2])) {
+                status = INTERFACE_BATCH_I2C_ERROR;
+                break;
+            }
+            i += 3 + ops[i + 2];
+        } else if (op == INTERFACE_OP_READ && i + 3 <= nBytes) {
+            uint8_t received[0x100];
+            if (!bus.read || !bus.read(ops[i + 1], received, ops[i + 2])) {
+                status = INTERFACE_BATCH_I2C_ERROR;
+                break;
+            }
+            results.insert(results.end(), received, received + ops[i + 2]);
+            i += 3;
+        } else if (op == INTERFACE_OP_WAIT_READY && i + 4 <= nBytes) {
+            if (!waitReady(ops[i + 1], (ops[i + 2] << 8) | ops[i + 3])) {
+                status = INTERFACE_BATCH_TIMEOUT;
+                break;
+            }
+            i += 4;
+        } else if (op == INTERFACE_OP_MIFARE_READ && i + 17 <= nBytes && i + 17 + ops[i + 16] <= nBytes) {
+            status = mifareRead(ops[i + 1], (ops[i + 2] << 8) | ops[i + 3], ops + i + 4, results);
+            if (status != INTERFACE_BATCH_OK) break;
+            i += 17 + ops[i + 16];
+        } else if (op == INTERFACE_OP_MIFARE_WRITE && i + 17 <= nBytes && i + 17 + ops[i + 16] * 17 <= nBytes) {
+            status = mifareWrite(ops[i + 1], (ops[i + 2] << 8) | ops[i + 3], ops + i + 4, results);
+            if (status != INTERFACE_BATCH_OK) break;
+            i += 17 + ops[i + 16] * 17;
+        } else {
+            status = INTERFACE_BATCH_BAD_OP;
+            break;
+        }
+
+        index++;
+    }
+
+    uint16_t length = results.size() + 2;
+    reply.push_back(INTERFACE_ACK);
+    reply.push_back(length >> 8);
+    reply.push_back(length & 0xFF);
+    reply.push_back(status);
+    reply.push_back(index);
+    reply.insert(reply.end(), results.begin(), results.end());
+}
+
+bool BridgeEmulator::waitReady(uint8_t address, uint16_t timeoutMillis) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+
+    do {
+        uint8_t status;
+        if (!bus.read || !bus.read(address, &status, 1)) return false;
+        if (status & 0x01) return true;
+    } while (std::chrono::steady_clock::now() < deadline);
+
+    return false;
+}
+
+uint8_t BridgeEmulator::mifareRead(uint8_t address, uint16_t timeoutMillis, const uint8_t* op, std::vector<uint8_t>& results) {
+    //op: tag, 0x60/0x61, key (6), UID (4), n, (n blocks)
+    uint8_t tag = op[0];
+    uint8_t nBlocks = op[12];
+    const uint8_t* blocks = op + 13;
+    
+    uint8_t command[14] = {0x40, tag, op[1], blocks[0]};
+    memcpy(command + 4, op + 2, 10); //Key and UID
+    
+    uint8_t pn532Status;
+    uint8_t result = dataExchange(address, timeoutMillis, command, 14, &pn532Status, nullptr, 0);
+    if (result != INTERFACE_BATCH_OK) return result;
+    
+    uint8_t blockData[0x100] = {};
+    for (uint8_t i = 0; i < nBlocks && pn532Status == 0x00; i++) {
+        uint8_t read[4] = {0x40, tag, 0x30, blocks[i]};
+        result = dataExchange(address, timeoutMillis, read, 4, &pn532Status, blockData + i * 0x10, 0x10);
+        if (result != INTERFACE_BATCH_OK) return result;
+        if (pn532Status != 0x00) memset(blockData + i * 0x10, 0, 0x10);
+    }
+    
+    results.push_back(pn532Status);
+    results.insert(results.end(), blockData, blockData + nBlocks * 0x10);
+    return INTERFACE_BATCH_OK;
+}
+
+uint8_t BridgeEmulator::mifareWrite(uint8_t address, uint16_t timeoutMillis, const uint8_t* op, std::vector<uint8_t>& results) {
+    //op: tag, 0x60/0x61, key (6), UID (4), n, n x (block, 16 bytes)
+    uint8_t tag = op[0];
+    uint8_t nBlocks = op[12];
+    const uint8_t* blocks = op + 13;
+    
+    uint8_t command[20] = {0x40, tag, op[1], blocks[0]};
+    memcpy(command + 4, op + 2, 10);
+    
+    uint8_t pn532Status;
+    uint8_t result = dataExchange(address, timeoutMillis, command, 14, &pn532Status, nullptr, 0);
+    if (result != INTERFACE_BATCH_OK) return result;
+    
+    for (uint8_t i = 0; i < nBlocks && pn532Status == 0x00; i++) {
+        command[2] = 0xA0;
+        command[3] = blocks[i * 17];
+        memcpy(command + 4, blocks + i * 17 + 1, 0x10);
+        result = dataExchange(address, timeoutMillis, command, 20, &pn532Status, nullptr, 0);
+        if (result != INTERFACE_BATCH_OK) return result;
+    }
+    
+    results.push_back(pn532Status);
+    return INTERFACE_BATCH_OK;
+}
+
+uint8_t BridgeEmulator::dataExchange(uint8_t address, uint16_t timeoutMillis, const uint8_t* command, uint8_t nBytes, uint8_t* status,
+                                     uint8_t* destination, uint8_t nData) {
+    static const uint8_t ACK[6] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+    
+    //Preamble, start code, LEN, LCS, TFI, command, DCS, postamble
+    uint8_t frame[0x40];
+    frame[0] = 0x00;
+    frame[1] = 0x00;
+    frame[2] = 0xFF;
+    frame[3] = nBytes + 1;
+    frame[4] = ~frame[3] + 1;
+    frame[5] = 0xD4;
+    uint8_t checksum = 0xD4;
+    for (uint8_t i = 0; i < nBytes; i++) {
+        frame[6 + i] = command[i];
+        checksum += command[i];
+    }
+    frame[6 + nBytes] = ~checksum + 1;
+    frame[7 + nBytes] = 0x00;
+    
+    if (!bus.write || !bus.write(address, frame, nBytes + 8)) return INTERFACE_BATCH_I2C_ERROR;
+    
+    uint8_t ack[7];
+    if (!waitReady(address, timeoutMillis)) return INTERFACE_BATCH_TIMEOUT;
+    if (!bus.read(address, ack, 7)) return INTERFACE_BATCH_I2C_ERROR;
+    if (memcmp(ack + 1, ACK, 6) != 0) return INTERFACE_BATCH_FRAME_ERROR;
+    
+    //Ready byte, 00 00 FF, LEN, LCS, D5 41, status, data, DCS, postamble
+    uint8_t response[0x40];
+    if (!waitReady(address, timeoutMillis)) return INTERFACE_BATCH_TIMEOUT;
+    if (!bus.read(address, response, nData + 11)) return INTERFACE_BATCH_I2C_ERROR;
+    if (response[1] != 0x00 || response[2] != 0x00 || response[3] != 0xFF || (uint8_t)(response[4] + response[5]) != 0 ||
+        response[6] != 0xD5 || response[7] != 0x41) return INTERFACE_BATCH_FRAME_ERROR;
+    
+    *status = response[8];
+    if (*status == 0x00 && destination) memcpy(destination, response + 9, nData);
+    return INTERFACE_BATCH_OK;
+}
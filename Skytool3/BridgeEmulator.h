@@ -0,0 +1,90 @@
+#ifndef BRIDGEEMULATOR_H_GUARD_
+#define BRIDGEEMULATOR_H_GUARD_
+
+/*
+ The adapter side of the bridge protocol (see Interface.h), as a reference for adapter firmware and for trying the host side
+ without an adapter.  Bytes from the host go in through feed, and whatever the adapter would send back comes out of it.  The I2C
+ bus is whatever the handlers do, e.g. on an Arduino they would wrap Wire, e.g.
+
+    BridgeEmulator::Bus bus;
+    bus.write = [](uint8_t address, const uint8_t* data, uint8_t nBytes) { ...; return true; };
+    bus.read = [](uint8_t address, uint8_t* destination, uint8_t nBytes) { ...; return true; };
+
+    BridgeEmulator bridge(bus, 115200);
+    std::vector<uint8_t> reply;
+    bridge.feed(received, nReceived, reply);
+    ...
+    bridge.poll(); //Every time round the loop, so a rate change can be reverted even with nothing coming in
+
+ Packets can be fed in pieces, anything before a start marker or with a bad length checksum is dropped.  The MIFARE batch operations
+ assume the device at the address is a PN532.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include "Interface.h"
+
+class BridgeEmulator {
+public:
+    struct Bus {
+        std::function<bool(uint8_t address, const uint8_t* data, uint8_t nBytes)> write;
+        std::function<bool(uint8_t address, uint8_t* destination, uint8_t nBytes)> read;
+        std::function<void(uint32_t baud)> setBaud; //Optional, called after the ACK for INTERFACE_SET_BAUD has been queued, and to revert
+    };
+    
+    static constexpr uint8_t CAPABILITIES = INTERFACE_CAP_BATCH | INTERFACE_CAP_MIFARE;
+
+    /*
+     baud: the rate the serial port starts at, to go back to if a change doesn't work out
+     */
+    BridgeEmulator(Bus bus, uint32_t baud);
+
+    /*
+     feed: hands over bytes received from the host and carries out any complete packets
+
+     reply: bytes to send back to the host are appended to this
+     */
+    void feed(const uint8_t* data, size_t nBytes, std::vector<uint8_t>& reply);
+    
+    /*
+     poll: goes back to the old rate if INTERFACE_BAUD_REVERT_MS have passed since an INTERFACE_SET_BAUD without a good packet at the new
+     rate.  feed calls this too.
+     */
+    void poll();
+
+private:
+    Bus bus;
+    std::vector<uint8_t> pending;
+    uint32_t baud;
+    uint32_t revertBaud = 0; //Non-zero while a rate change is on trial
+    std::chrono::steady_clock::time_point revertDeadline;
+
+    void handlePacket(const uint8_t* packet, uint8_t length, std::vector<uint8_t>& reply);
+    void handleControl(uint8_t control, const uint8_t* data, uint8_t nBytes, std::vector<uint8_t>& reply);
+    void runBatch(const uint8_t* ops, uint8_t nBytes, std::vector<uint8_t>& reply);
+    bool waitReady(uint8_t address, uint16_t timeoutMillis);
+    
+    /*
+     mifareRead/mifareWrite: INTERFACE_OP_MIFARE_READ/WRITE, from the operation's tag byte onwards
+     
+     return value: INTERFACE_BATCH_OK, or why the batch has to stop
+     */
+    uint8_t mifareRead(uint8_t address, uint16_t timeoutMillis, const uint8_t* op, std::vector<uint8_t>& results);
+    uint8_t mifareWrite(uint8_t address, uint16_t timeoutMillis, const uint8_t* op, std::vector<uint8_t>& results);
+    
+    /*
+     dataExchange: one PN532 InDataExchange command (write, wait, ACK, wait, response)
+     
+     status: destination for the PN532 status byte
+     destination: destination for the nData bytes after the status byte
+     
+     return value: INTERFACE_BATCH_OK, or why it couldn't be done
+     */
+    uint8_t dataExchange(uint8_t address, uint16_t timeoutMillis, const uint8_t* command, uint8_t nBytes, uint8_t* status,
+                         uint8_t* destination, uint8_t nData);
+};
+
+#endif
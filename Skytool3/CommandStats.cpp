@@ -0,0 +1,177 @@
+#include "CommandStats.h"
+#include "PN532.h"
+#include <iomanip>
+#include <sstream>
+
+/*
+*******************************************************************************
+*******************************************************************************
+HISTOGRAM**********************************************************************
+*******************************************************************************
+*******************************************************************************
+*/
+
+void LatencyHistogram::record(uint32_t micros) {
+    buckets[bucketOf(micros)]++;
+    total++;
+    sum += micros;
+    if (micros < lowest) lowest = micros;
+    if (micros > highest) highest = micros;
+}
+
+uint64_t LatencyHistogram::count() const {
+    return total;
+}
+
+uint32_t LatencyHistogram::min() const {
+    return total ? lowest : 0;
+}
+
+uint32_t LatencyHistogram::max() const {
+    return highest;
+}
+
+double LatencyHistogram::mean() const {
+    return total ? (double)sum / total : 0;
+}
+
+uint32_t LatencyHistogram::percentile(double p) const {
+    if (total == 0) return 0;
+    
+    uint64_t target = (uint64_t)(p / 100 * total + 0.5);
+    if (target == 0) target = 1;
+    
+    uint64_t seen = 0;
+    for (uint16_t bucket = 0; bucket < BUCKETS; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= target) return std::min(bucketTop(bucket), highest);
+    }
+    return highest;
+}
+
+uint16_t LatencyHistogram::bucketOf(uint32_t micros) {
+    if (micros < SUB_COUNT) return micros;
+    
+    uint8_t msb = 31 - __builtin_clz(micros);
+    uint8_t shift = msb - (SUB_BITS - 1);
+    uint32_t mantissa = micros >> shift; //SUB_COUNT / 2 to SUB_COUNT - 1
+    
+    return SUB_COUNT + (shift - 1) * (SUB_COUNT / 2) + (mantissa - SUB_COUNT / 2);
+}
+
+uint32_t LatencyHistogram::bucketTop(uint16_t bucket) {
+    if (bucket < SUB_COUNT) return bucket;
+    
+    uint8_t shift = (bucket - SUB_COUNT) / (SUB_COUNT / 2) + 1;
+    uint64_t mantissa = (bucket - SUB_COUNT) % (SUB_COUNT / 2) + SUB_COUNT / 2;
+    
+    return (uint32_t)std::min<uint64_t>(((mantissa + 1) << shift) - 1, UINT32_MAX);
+}
+
+/*
+*******************************************************************************
+*******************************************************************************
+COMMANDS***********************************************************************
+*******************************************************************************
+*******************************************************************************
+*/
+
+uint16_t CommandStats::keyOf(const uint8_t* command, uint8_t len) {
+    uint16_t key = command[0] << 8;
+    if (command[0] == PN532::InDataExchange_CMD && len > 2) key |= command[2]; //The MIFARE command
+    return key;
+}
+
+std::string CommandStats::name(uint16_t key) {
+    std::string out;
+    
+    switch (key >> 8) {
+        case PN532::GetFirmwareVersion_CMD: out = "GetFirmwareVersion"; break;
+        case PN532::ReadRegister_CMD: out = "ReadRegister"; break;
+        case PN532::WriteRegister_CMD: out = "WriteRegister"; break;
+        case PN532::SAMConfiguration_CMD: out = "SAMConfiguration"; break;
+        case PN532::RFConfiguration_CMD: out = "RFConfiguration"; break;
+        case PN532::InListPassiveTarget_CMD: out = "InListPassiveTarget"; break;
+        case PN532::InDataExchange_CMD: out = "InDataExchange"; break;
+        case PN532::InCommunicateThru_CMD: out = "InCommunicateThru"; break;
+        case PN532::InSelect_CMD: out = "InSelect"; break;
+        case PN532::InAutoPoll_CMD: out = "InAutoPoll"; break;
+        default: {
+            std::stringstream stream;
+            stream << "0x" << std::hex << std::setw(2) << std::setfill('0') << (key >> 8);
+            out = stream.str();
+        }
+    }
+    
+    if ((key >> 8) == PN532::InDataExchange_CMD) {
+        switch (key & 0xFF) {
+            case 0x30: out += "/read"; break;
+            case 0xA0: out += "/write"; break;
+            case 0x60: out += "/authA"; break;
+            case 0x61: out += "/authB"; break;
+            default: out += "/other"; break;
+        }
+    }
+    
+    return out;
+}
+
+void CommandStats::record(uint16_t key, uint32_t writeMicros, uint32_t waitMicros, uint32_t responseMicros) {
+    phases& command = commands[key];
+    command.write.record(writeMicros);
+    command.wait.record(waitMicros);
+    command.response.record(responseMicros);
+}
+
+const std::map<uint16_t, CommandStats::phases>& CommandStats::all() const {
+    return commands;
+}
+
+void CommandStats::clear() {
+    commands.clear();
+}
+
+void CommandStats::writeText(std::ostream& out) const {
+    static const char* phaseNames[3] = {"write", "wait", "response"};
+    
+    out << std::left << std::setw(24) << "command" << std::setw(10) << "phase" << std::right << std::setw(8) << "count"
+        << std::setw(10) << "mean" << std::setw(8) << "min" << std::setw(8) << "p50" << std::setw(8) << "p90"
+        << std::setw(8) << "p99" << std::setw(8) << "max" << std::endl;
+    
+    for (const auto& command : commands) {
+        const LatencyHistogram* histograms[3] = {&command.second.write, &command.second.wait, &command.second.response};
+        
+        for (uint8_t i = 0; i < 3; i++) {
+            const LatencyHistogram& h = *histograms[i];
+            out << std::left << std::setw(24) << name(command.first) << std::setw(10) << phaseNames[i] << std::right << std::dec
+                << std::setw(8) << h.count() << std::setw(10) << std::fixed << std::setprecision(1) << h.mean()
+                << std::setw(8) << h.min() << std::setw(8) << h.percentile(50) << std::setw(8) << h.percentile(90)
+                << std::setw(8) << h.percentile(99) << std::setw(8) << h.max() << std::endl;
+        }
+    }
+}
+
+void CommandStats::writeJSON(std::ostream& out) const {
+    static const char* phaseNames[3] = {"write", "wait", "response"};
+    
+    out << "{" << std::dec;
+    bool firstCommand = true;
+    
+    for (const auto& command : commands) {
+        const LatencyHistogram* histograms[3] = {&command.second.write, &command.second.wait, &command.second.response};
+        
+        out << (firstCommand ? "" : ",") << "\"" << name(command.first) << "\":{";
+        firstCommand = false;
+        
+        for (uint8_t i = 0; i < 3; i++) {
+            const LatencyHistogram& h = *histograms[i];
+            out << (i ? "," : "") << "\"" << phaseNames[i] << "\":{"
+                << "\"count\":" << h.count() << ",\"mean\":" << h.mean() << ",\"min\":" << h.min()
+                << ",\"p50\":" << h.percentile(50) << ",\"p90\":" << h.percentile(90) << ",\"p99\":" << h.percentile(99)
+                << ",\"max\":" << h.max() << "}";
+        }
+        out << "}";
+    }
+    
+    out << "}" << std::endl;
+}
@@ -0,0 +1,98 @@
+#ifndef COMMANDSTATS_H_GUARD_
+#define COMMANDSTATS_H_GUARD_
+
+/*
+ Timing statistics for PN532 commands, to find out where the time goes when reading/writing figures - the serial link and bridge, the
+ PN532, or the tag.
+ 
+ Each command is timed in three phases:
+    -write: sending the command frame and getting the PN532's ACK back
+    -wait: from the ACK until the response is ready to read (the InAutoPoll polling time, and anything else that waits for the ready byte)
+    -response: reading the response frame
+ 
+ and each phase goes into a log-linear (HDR style) histogram for that command.  InDataExchange is split up by the MIFARE command in it
+ (read, write, authenticate A/B), since those behave very differently.
+ 
+ When the bridge runs the whole command as one batch (see BridgeTransport::exchange) the phases can't be told apart, so all of the time
+ goes in the response phase and the write and wait phases record 0.
+ 
+ Nothing is timed unless a CommandStats is given to the PN532, e.g.
+ 
+    CommandStats stats;
+    pn->setStats(&stats);
+    sk->read(pn);
+    stats.writeText(std::cout);
+ */
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <ostream>
+
+class LatencyHistogram {
+public:
+    /*
+     Values below SUB_COUNT microseconds are exact, above that each power of two is split into SUB_COUNT / 2 buckets (so within ~12%),
+     up to about 70 minutes.
+     */
+    static constexpr uint8_t SUB_BITS = 4;
+    static constexpr uint16_t SUB_COUNT = 1 << SUB_BITS;
+    static constexpr uint16_t BUCKETS = SUB_COUNT + (32 - SUB_BITS) * (SUB_COUNT / 2);
+    
+    void record(uint32_t micros);
+    
+    uint64_t count() const;
+    uint32_t min() const;
+    uint32_t max() const;
+    double mean() const;
+    
+    /*
+     percentile: upper bound of the bucket containing the given percentile (0 - 100)
+     */
+    uint32_t percentile(double p) const;
+    
+private:
+    uint64_t buckets[BUCKETS] = {};
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint32_t lowest = UINT32_MAX;
+    uint32_t highest = 0;
+    
+    static uint16_t bucketOf(uint32_t micros);
+    static uint32_t bucketTop(uint16_t bucket);
+};
+
+class CommandStats {
+public:
+    struct phases {
+        LatencyHistogram write;
+        LatencyHistogram wait;
+        LatencyHistogram response;
+    };
+    
+    /*
+     keyOf: the key a command frame (starting at the command code) is recorded under
+     */
+    static uint16_t keyOf(const uint8_t* command, uint8_t len);
+    
+    /*
+     name: readable name for a key, e.g. "InDataExchange/read"
+     */
+    static std::string name(uint16_t key);
+    
+    void record(uint16_t key, uint32_t writeMicros, uint32_t waitMicros, uint32_t responseMicros);
+    
+    const std::map<uint16_t, phases>& all() const;
+    void clear();
+    
+    /*
+     writeText/writeJSON: count, mean, min, p50, p90, p99 and max of each phase of each command, in microseconds
+     */
+    void writeText(std::ostream& out) const;
+    void writeJSON(std::ostream& out) const;
+    
+private:
+    std::map<uint16_t, phases> commands;
+};
+
+#endif
@@ -85,6 +85,17 @@ void Encryption::decryptBlock(Skylander* target, uint8_t block) {
 	aes.DecryptECB(target->data[block], 16, key);
 }
 
+void Encryption::decryptBlock(Skylander* target, uint8_t block, uint8_t destination[0x10]) {
+    if (!shouldEncryptBlock(block)) throw CodedException(0x0D);
+	
+	AES aes(128);
+	uint8_t key[16];
+	calcAESKey(target, block, key);
+	
+	memcpy(destination, target->data[block], 16);
+	aes.DecryptECB(destination, 16, key);
+}
+
 void Encryption::encryptBlock(Skylander* target, uint8_t block) {
     if (!shouldEncryptBlock(block)) throw CodedException(0x0D);
 
@@ -51,6 +51,7 @@ class Encryption {
 	
 		static void calcAESKey(Skylander* target, uint8_t block, uint8_t destination[0x10]);
 		static void decryptBlock(Skylander* target, uint8_t block);
+		static void decryptBlock(Skylander* target, uint8_t block, uint8_t destination[0x10]); //Decrypts a copy, leaving the Skylander as is
 		static void encryptBlock(Skylander* target, uint8_t block);
 
 		static bool isEncrypted(Skylander* target);
@@ -0,0 +1,35 @@
+#include "FigureCache.h"
+#include "MIFARE_1K.h"
+
+bool FigureCache::lookup(const uint8_t uid[0x04], FigureImage& destination) const {
+    auto it = images.find(key(uid));
+    if (it == images.end()) return false;
+    
+    destination = it->second;
+    return true;
+}
+
+void FigureCache::store(MIFARE_1K& figure) {
+    uint8_t uid[0x04];
+    figure.getUID(uid);
+    
+    FigureImage& cached = images[key(uid)];
+    cached = *figure.getImage();
+    cached.clearAltered();
+}
+
+void FigureCache::forget(const uint8_t uid[0x04]) {
+    images.erase(key(uid));
+}
+
+void FigureCache::clear() {
+    images.clear();
+}
+
+size_t FigureCache::size() const {
+    return images.size();
+}
+
+uint32_t FigureCache::key(const uint8_t uid[0x04]) {
+    return bytesToInt((uint8_t*)uid, 0x04, false);
+}
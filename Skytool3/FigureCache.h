@@ -0,0 +1,46 @@
+#ifndef FIGURECACHE_H_GUARD_
+#define FIGURECACHE_H_GUARD_
+
+/*
+ A cache of the last full image read from each figure, keyed by UID.
+ 
+ Figures tend to come back to the same reader over and over, and most of the time nothing on them has changed.  See
+ Skylander::readCached, which uses this to avoid reading the whole figure again.
+ 
+ Anything that writes to a figure should store the new image afterwards, otherwise the cache will be out of date.
+ */
+
+#include <stdint.h>
+#include <unordered_map>
+#include "FigureImage.h"
+
+class MIFARE_1K;
+
+class FigureCache {
+public:
+    /*
+     lookup: gets the cached image for a UID
+     
+     uid: the UID to look for
+     destination: where to copy the image
+     
+     return value: whether there was one
+     */
+    bool lookup(const uint8_t uid[0x04], FigureImage& destination) const;
+    
+    /*
+     store: saves (or replaces) the image of a figure, under its UID
+     */
+    void store(MIFARE_1K& figure);
+    
+    void forget(const uint8_t uid[0x04]);
+    void clear();
+    size_t size() const;
+    
+private:
+    std::unordered_map<uint32_t, FigureImage> images;
+    
+    static uint32_t key(const uint8_t uid[0x04]);
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include "FigureImage.h"
+#include "misc.h"
+
+FigureArena::FigureArena(size_t capacity) : count(0), maxCount(capacity) {
+    images = new FigureImage[capacity]; //Left uninitialised, allocate clears each image as it is handed out
+}
+
+FigureArena::~FigureArena() {
+    delete [] images;
+}
+
+FigureImage* FigureArena::allocate() {
+    if (count >= maxCount) throw CodedException(0x17);
+    
+    FigureImage* image = &images[count++];
+    memset(image, 0x00, sizeof(FigureImage));
+    return image;
+}
+
+FigureImage* FigureArena::loadFile(const char* filename) {
+    FigureImage* image = allocate();
+    
+    try {
+        readFile(filename, &image->data[0][0], 0x400);
+    } catch (...) {
+        count--;
+        throw;
+    }
+    
+    return image;
+}
+
+void FigureArena::reset() {
+    count = 0;
+}
@@ -0,0 +1,94 @@
+#ifndef FIGUREIMAGE_H_GUARD_
+#define FIGUREIMAGE_H_GUARD_
+
+/*
+ A compact image of a MIFARE 1K figure - just the 1K of card data and a bit mask of which blocks have been altered (bit n = block n).
+ 
+ It is plain data (trivially copyable, no pointers), so whole collections of figures can be kept in one allocation and copied/saved with
+ memcpy.  The keys, access bits and spare byte are not stored separately, the accessors below just point into the sector trailers.
+ 
+ Images are aligned to a cache line rather than to 1K - 1K alignment would pad every image out to 2K because of the mask.
+ 
+ For holding lots of figures at once, use a FigureArena, and wrap any image in a Skylander (or MIFARE_1K) without copying it:
+ 
+    FigureArena arena(100000);
+    FigureImage* image = arena.loadFile("dumps/1/Figures/Bash.dump");
+    Skylander view(image); //Reads and writes go straight to the arena
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+
+struct alignas(0x40) FigureImage {
+    uint8_t data[0x40][0x10];
+    uint64_t altered;
+    
+    uint8_t* uid() { return data[0x00]; }
+    
+    //Views into the sector trailers
+    uint8_t* keyA(uint8_t sector) { return &data[sector * 4 + 3][0x00]; }
+    uint8_t* accessBits(uint8_t sector) { return &data[sector * 4 + 3][0x06]; }
+    uint8_t* spareByte(uint8_t sector) { return &data[sector * 4 + 3][0x09]; }
+    uint8_t* keyB(uint8_t sector) { return &data[sector * 4 + 3][0x0A]; }
+    
+    //Dirty mask
+    void flag(uint8_t block) { altered |= (1ULL << block); }
+    bool isAltered(uint8_t block) const { return (altered >> block) & 0x01; }
+    void clearAltered(uint8_t block) { altered &= ~(1ULL << block); }
+    void clearAltered() { altered = 0; }
+};
+
+static_assert(std::is_trivially_copyable<FigureImage>::value, "FigureImage must stay plain data");
+static_assert(std::is_standard_layout<FigureImage>::value, "FigureImage must stay plain data");
+static_assert(sizeof(FigureImage) == 0x440, "FigureImage should be the card data, mask, and padding to a cache line");
+
+
+/*
+ A fixed size pool of FigureImages, all in one allocation.  Images are handed out in order and are never freed individually -
+ call reset to reuse the whole pool.
+ */
+class FigureArena {
+public:
+    /*
+     FigureArena: allocates space for a number of images
+     
+     capacity: the maximum number of images
+     */
+    FigureArena(size_t capacity);
+    ~FigureArena();
+    
+    FigureArena(const FigureArena&) = delete;
+    FigureArena& operator=(const FigureArena&) = delete;
+    
+    /*
+     allocate: takes the next image from the pool, cleared to zero.  Throws an exception if the pool is full.
+     */
+    FigureImage* allocate();
+    
+    /*
+     loadFile: allocates an image and reads a dump file into it
+     
+     filename: the dump file (0x400 bytes)
+     */
+    FigureImage* loadFile(const char* filename);
+    
+    /*
+     reset: forgets every image, so the pool can be reused.  Any pointers to images handed out before are then invalid.
+     */
+    void reset();
+    
+    size_t size() const { return count; }
+    size_t capacity() const { return maxCount; }
+    
+    FigureImage& operator[](size_t i) { return images[i]; }
+    FigureImage* begin() { return images; }
+    FigureImage* end() { return images + count; }
+    
+private:
+    FigureImage* images;
+    size_t count;
+    size_t maxCount;
+};
+
+#endif
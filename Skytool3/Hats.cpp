@@ -6,283 +6,387 @@
 //
 
 #include "Hats.h"
+#include <array>
 
-using namespace std;
+namespace {
 
-map<uint16_t, string> hatsMap = {
+struct hatInfo {
+    uint16_t code;
+    const char* name;
+};
+
+//Must be kept in order of code (checked below), each name only once
+constexpr hatInfo hats[] = {
+    //Spyro's adventure
+    {1, "Combat Hat"},
+    {2, "Napoleon Hat"},
+    {3, "Spy Gear"},
+    {4, "Miner Hat"},
+    {5, "General's Hat"},
+    {6, "Pirate Hat"},
+    {7, "Propeller Hat"},
+    {8, "Coonskin Cap"},
+    {9, "Straw Hat"},
+    {10, "Fancy Hat"},
+    {11, "Top Hat"},
+    {12, "Viking Helmet"},
+    {13, "Spiked Hat"},
     {14, "Anvil Hat"},
-    {44, "Balloon Hat"},
     {15, "Beret"},
     {16, "Birthday Hat"},
     {17, "Bone Head"},
     {18, "Bowler Hat"},
+    {19, "Wabbit Ears"},
+    {20, "Tropical Turban"},
     {21, "Chef Hat"},
-    {1, "Combat Hat"},
-    {8, "Coonskin Cap"},
-    {42, "Cossack Hat"},
     {22, "Cowboy Hat"},
-    {28, "Crown of Light"},
+    {23, "Rocker Hair"},
+    {24, "Royal Crown"},
+    {25, "Lil Devil"},
     {26, "Eye Hat"},
-    {10, "Fancy Hat"},
     {27, "Fez"},
-    {43, "Flower Hat"},
-    {5, "General's Hat"},
-    {45, "Happy Birthday!"},
+    {28, "Crown of Light"},
     {29, "Jester Hat"},
-    {25, "Lil Devil"},
-    {4, "Miner Hat"},
+    {30, "Winged Hat"},
     {31, "Moose Hat"},
-    {2, "Napoleon Hat"},
-    {33, "Pan Hat"},
-    {41, "Pirate Doo Rag"},
-    {6, "Pirate Hat"},
     {32, "Plunger Head"},
-    {7, "Propeller Hat"},
-    {40, "Pumpkin Hat"},
-    {23, "Rocker Hair"},
+    {33, "Pan Hat"},
     {34, "Rocket Hat"},
-    {24, "Royal Crown"},
     {35, "Santa Hat"},
-    {13, "Spiked Hat"},
-    {3, "Spy Gear"},
-    {9, "Straw Hat"},
     {36, "Tiki Hat"},
-    {11, "Top Hat"},
     {37, "Trojan Helmet"},
-    {20, "Tropical Turban"},
     {38, "Unicorn Hat"},
-    {12, "Viking Helmet"},
-    {19, "Wabbit Ears"},
-    {30, "Winged Hat"},
     {39, "Wizard Hat"},
+    {40, "Pumpkin Hat"},
+    {41, "Pirate Doo Rag"},
+    {42, "Cossack Hat"},
+    {43, "Flower Hat"},
+    {44, "Balloon Hat"},
+    {45, "Happy Birthday!"},
     //Giants
-    {59, "Archer Hat"},
-    {88, "Atom Hat"},
-    {67, "Battle Helmet"},
-    {87, "Biter Hat"},
-    {68, "Bottle Cap Hat"},
+    {46, "Vintage Baseball Cap"},
     {48, "Bowling Pin Hat"},
-    {94, "Bronze Top Hat"},
-    {83, "Caesar Hat"},
-    {70, "Carrot Hat"},
-    {64, "Dancer Hat"},
-    {93, "Dangling Carrot Hat"},
-    {72, "Elf Hat"},
+    {49, "Officer Hat"},
     {50, "Firefighter Hat"},
-    {73, "Fishing Hat"},
-    {84, "Flower Fairy Hat"},
-    {85, "Funnel Hat"},
-    {74, "Future Hat"},
-    {96, "Gold Top Hat"},
     {51, "Graduation Hat"},
-    {92, "Knight Helm"},
-    {91, "Kufi Hat"},
     {52, "Lampshade Hat"},
     {53, "Mariachi Hat"},
-    {75, "Nefertiti Hat"},
-    {49, "Officer Hat"},
-    {77, "Pants Hat"},
     {55, "Paper Fast Food Hat"},
     {56, "Pilgrim Hat"},
     {57, "Police Siren Hat"},
-    {78, "Princess Hat"},
     {58, "Purple Fedora"},
-    {90, "Rasta Hat"},
+    {59, "Archer Hat"},
     {61, "Safari Hat"},
     {62, "Sailor Hat"},
-    {86, "Scrumshanks Hat"},
-    {82, "Showtime Hat"},
-    {95, "Silver Top Hat"},
-    {89, "Sombrero"},
-    {79, "Toy Soldier Hat"},
+    {64, "Dancer Hat"},
     {65, "Traffic Cone Hat"},
-    {80, "Trucker Hat"},
     {66, "Turban"},
+    {67, "Battle Helmet"},
+    {68, "Bottle Cap Hat"},
+    {70, "Carrot Hat"},
+    {72, "Elf Hat"},
+    {73, "Fishing Hat"},
+    {74, "Future Hat"},
+    {75, "Nefertiti Hat"},
+    {77, "Pants Hat"},
+    {78, "Princess Hat"},
+    {79, "Toy Soldier Hat"},
+    {80, "Trucker Hat"},
     {81, "Umbrella Hat"},
-    {46, "Vintage Baseball Cap"},
+    {82, "Showtime Hat"},
+    {83, "Caesar Hat"},
+    {84, "Flower Fairy Hat"},
+    {85, "Funnel Hat"},
+    {86, "Scrumshanks Hat"},
+    {87, "Biter Hat"},
+    {88, "Atom Hat"},
+    {89, "Sombrero"},
+    {90, "Rasta Hat"},
+    {91, "Kufi Hat"},
+    {92, "Knight Helm"},
+    {93, "Dangling Carrot Hat"},
+    {94, "Bronze Top Hat"},
+    {95, "Silver Top Hat"},
+    {96, "Gold Top Hat"},
     //Swap force
-    {121, "Asteroid Hat"},
-    {120, "Aviator's Cap"},
-    {150, "Awesome Hat"},
-    {149, "Bacon Bandana"},
-    {117, "Beacon Hat"},
-    {126, "Beanie Cap"},
-    {112, "Bearskin Cap"},
+    {97, "Rain Hat"},
+    {98, "The Outsider"},
+    {99, "Greeble Hat"},
+    {100, "Volcano Hat"},
     {101, "Boater Hat"},
+    {102, "Stone Hat"},
+    {103, "Stovepipe Hat"},
     {104, "Boonie Hat"},
-    {140, "Cactus Hat"},
+    {105, "Sawblade Hat"},
+    {106, "Zombeanie"},
+    {107, "Gaucho Hat"},
+    {108, "Roundlet"},
     {109, "Capuchon"},
-    {151, "Card Shark Hat"},
-    {139, "Clockwork Hat"},
-    {123, "Creepy Helm"},
-    {137, "Crown of Flames"},
+    {110, "Tricorn Hat"},
+    {111, "Peacock Hat"},
+    {112, "Bearskin Cap"},
+    {113, "Fishbone Hat"},
+    {114, "Ski Cap"},
     {115, "Crown of Frost"},
+    {116, "Four Winds Hat"},
+    {117, "Beacon Hat"},
+    {118, "Flower Garland"},
+    {119, "Tree Branch"},
+    {120, "Aviator's Cap"},
+    {121, "Asteroid Hat"},
     {122, "Crystal Hat"},
-    {93, "Dangling Carrot Hat"},
-    {125, "Deely Boppers"},
-    {144, "Elephant Hat"},
-    {148, "Eyefro"},
+    {123, "Creepy Helm"},
     {124, "Fancy Ribbon"},
-    {113, "Fishbone Hat"},
-    {118, "Flower Garland"},
-    {116, "Four Winds Hat"},
-    {107, "Gaucho Hat"},
-    {130, "Glittering Tiara"},
-    {142, "Gloop Hat"},
-    {131, "Great Helm"},
-    {99, "Greeble Hat"},
-    {152, "Jolly Hat"},
-    {153, "Kickoff Hat"},
+    {125, "Deely Boppers"},
+    {126, "Beanie Cap"},
     {127, "Leprechaun Hat"},
+    {128, "Shark Hat"},
     {129, "Life Preserver Hat"},
-    {136, "Lilypad Hat"},
+    {130, "Glittering Tiara"},
+    {131, "Great Helm"},
+    {132, "Space Helmet"},
+    {133, "UFO Hat"},
+    {134, "Whirlwind Diadem"},
     {135, "Obsidian Helm"},
-    {55, "Paper Fast Food Hat"},
-    {111, "Peacock Hat"},
-    {143, "Puma Hat"},
-    {97, "Rain Hat"},
-    {108, "Roundlet"},
+    {136, "Lilypad Hat"},
+    {137, "Crown of Flames"},
     {138, "Runic Headband"},
-    {105, "Sawblade Hat"},
-    {128, "Shark Hat"},
-    {114, "Ski Cap"},
+    {139, "Clockwork Hat"},
+    {140, "Cactus Hat"},
     {141, "Skullhelm"},
-    {132, "Space Helmet"},
-    {154, "Springtime Hat"},
-    {102, "Stone Hat"},
-    {103, "Stovepipe Hat"},
-    {146, "Teeth Top Hat"},
-    {98, "The Outsider"},
+    {142, "Gloop Hat"},
+    {143, "Puma Hat"},
+    {144, "Elephant Hat"},
     {145, "Tiger Skin Cap"},
-    {119, "Tree Branch"},
-    {110, "Tricorn Hat"},
+    {146, "Teeth Top Hat"},
     {147, "Turkey Hat"},
-    {133, "UFO Hat"},
-    {100, "Volcano Hat"},
-    {134, "Whirlwind Diadem"},
-    {106, "Zombeanie"},
-    //Trap team
-    {211, "Alarm Clock Hat"},
-    {218, "Bat Hat"},
-    {212, "Batter Up Hat"},
+    {148, "Eyefro"},
+    {149, "Bacon Bandana"},
+    {150, "Awesome Hat"},
+    {151, "Card Shark Hat"},
+    {152, "Jolly Hat"},
+    {153, "Kickoff Hat"},
+    {154, "Springtime Hat"},
     {155, "Beetle Hat"},
-    {237, "Bellhop Hat"},
-    {195, "Bobby"},
+    //Trap team
     {156, "Brain Hat"},
     {157, "Brainiac Hat"},
-    {238, "Bronze Arkeyan Helm"},
     {158, "Bucket Hat"},
-    {234, "Candle Hat"},
-    {232, "Candy Cane Hat"},
-    {246, "Carnival Hat"},
+    {159, "Desert Crown"},
     {160, "Ceiling Fan Hat"},
-    {187, "Classic Pot Hat"},
-    {163, "Clown Bowler Hat"},
+    {161, "Imperial Hat"},
     {162, "Clown Classic Hat"},
-    {247, "Coconut Hat"},
+    {163, "Clown Bowler Hat"},
     {164, "Colander Hat"},
-    {252, "Core Of Light Hat"},
+    {165, "Kepi Hat"},
     {166, "Cornucopia Hat"},
-    {189, "Crazy Light Bulb Hat"},
-    {214, "Croissant Hat"},
     {167, "Cubano Hat"},
     {168, "Cycling Hat"},
     {169, "Daisy Crown"},
-    {235, "Dark Helm"},
-    {159, "Desert Crown"},
     {170, "Dragon Skull"},
-    {233, "Eggshell Hat"},
-    {203, "Extreme Viking Hat"},
-    {217, "Eye of Kaos Hat"},
-    {220, "Firefly Jar"},
-    {198, "Flight Attendant Hat"},
-    {174, "Garrison Hat"},
+    {171, "Outback Hat"},
+    {172, "Lil' Elf Hat"},
     {173, "Generalissimo"},
-    {226, "Gold Arkeyan Helm"},
+    {174, "Garrison Hat"},
     {175, "Gondolier Hat"},
-    {196, "Hedgehog Hat"},
-    {213, "Horns Be With You Hat"},
     {176, "Hunting Hat"},
-    {161, "Imperial Hat"},
     {177, "Juicer Hat"},
-    {165, "Kepi Hat"},
     {178, "Kokoshnik"},
-    {219, "Light Bulb Hat"},
-    {222, "Lighthouse Beacon Hat"},
-    {172, "Lil' Elf Hat"},
     {179, "Medic Hat"},
     {180, "Melon Hat"},
-    {192, "Metal Fin Hat"},
-    {229, "Miniature Skylands Hat"},
-    {250, "Molekin Mountain Hat"},
-    {199, "Monday Hat"},
     {181, "Mountie Hat"},
-    {224, "Night Cap"},
     {182, "Nurse Hat"},
-    {253, "Octavius Cloptimus Hat"},
-    {186, "Old-Time Movie Hat"},
-    {171, "Outback Hat"},
     {183, "Palm Hat"},
     {184, "Paperboy Hat"},
     {185, "Parrot Nest"},
-    {236, "Planet Hat"},
-    {210, "Pork Pie Hat"},
-    {228, "Pyramid Hat"},
+    {186, "Old-Time Movie Hat"},
+    {187, "Classic Pot Hat"},
     {188, "Radar Hat"},
-    {216, "Rainbow Hat"},
+    {189, "Crazy Light Bulb Hat"},
     {190, "Rubber Glove Hat"},
-    {209, "Rude Boy Hat"},
     {191, "Rugby Hat"},
-    {204, "Scooter Hat"},
-    {221, "Shadow Ghost Hat"},
-    {200, "Sherpa Hat"},
-    {194, "Shower Cap"},
-    {239, "Silver Arkeyan Helm"},
-    {243, "Skipper Hat"},
+    {192, "Metal Fin Hat"},
     {193, "Sleuth Hat"},
+    {194, "Shower Cap"},
+    {195, "Bobby"},
+    {196, "Hedgehog Hat"},
     {197, "Steampunk Hat"},
-    {225, "Storm Hat"},
-    {206, "Synchronized Swimming Cap"},
-    {223, "Tin Foil Hat"},
-    {227, "Toucan Hat"},
+    {198, "Flight Attendant Hat"},
+    {199, "Monday Hat"},
+    {200, "Sherpa Hat"},
     {201, "Trash Lid"},
-    {208, "Tribal Hat"},
     {202, "Turtle Hat"},
+    {203, "Extreme Viking Hat"},
+    {204, "Scooter Hat"},
     {205, "Volcano Island Hat"},
-    {215, "Weather Vane Hat"},
+    {206, "Synchronized Swimming Cap"},
     {207, "William Tell Hat"},
+    {208, "Tribal Hat"},
+    {209, "Rude Boy Hat"},
+    {210, "Pork Pie Hat"},
+    {211, "Alarm Clock Hat"},
+    {212, "Batter Up Hat"},
+    {213, "Horns Be With You Hat"},
+    {214, "Croissant Hat"},
+    {215, "Weather Vane Hat"},
+    {216, "Rainbow Hat"},
+    {217, "Eye of Kaos Hat"},
+    {218, "Bat Hat"},
+    {219, "Light Bulb Hat"},
+    {220, "Firefly Jar"},
+    {221, "Shadow Ghost Hat"},
+    {222, "Lighthouse Beacon Hat"},
+    {223, "Tin Foil Hat"},
+    {224, "Night Cap"},
+    {225, "Storm Hat"},
+    {226, "Gold Arkeyan Helm"},
+    {227, "Toucan Hat"},
+    {228, "Pyramid Hat"},
+    {229, "Miniature Skylands Hat"},
+    {232, "Candy Cane Hat"},
+    {233, "Eggshell Hat"},
+    {234, "Candle Hat"},
+    {235, "Dark Helm"},
+    {236, "Planet Hat"},
+    {237, "Bellhop Hat"},
+    {238, "Bronze Arkeyan Helm"},
+    {239, "Silver Arkeyan Helm"},
+    {243, "Skipper Hat"},
+    {246, "Carnival Hat"},
+    {247, "Coconut Hat"},
+    {250, "Molekin Mountain Hat"},
+    {252, "Core Of Light Hat"},
+    {253, "Octavius Cloptimus Hat"},
     //Superchargers
-    {261, "Burn-Cycle Header"},
-    {271, "Buzz Wing Hat"},
-    {276, "Crypt Crusher Cap"},
     {259, "Dive Bomber Hat"},
-    {279, "Eon’s Helm"},
-    {268, "Gold Rusher Cog Cap"},
-    {274, "Hot Streak Headpiece"},
-    {263, "Jet Stream Helmet"},
-    {278, "Kaos Krown"},
-    {277, "Mags Hat"},
-    {262, "Reef Ripper Helmet"},
     {260, "Sea Shadow Hat"},
-    {267, "Shark Tank Topper"},
-    {272, "Shield Striker Helmet"},
-    {275, "Sky Slicer Hat"},
+    {261, "Burn-Cycle Header"},
+    {262, "Reef Ripper Helmet"},
+    {263, "Jet Stream Helmet"},
     {264, "Soda Skimmer Shower Cap"},
-    {269, "Splatter Splasher Spires"},
+    {265, "Tomb Buggy Skullcap"},
     {266, "Stealth Stinger Beanie"},
-    {273, "Sun Runner Spikes"},
+    {267, "Shark Tank Topper"},
+    {268, "Gold Rusher Cog Cap"},
+    {269, "Splatter Splasher Spires"},
     {270, "Thump Trucker’s Hat"},
-    {265, "Tomb Buggy Skullcap"}
+    {271, "Buzz Wing Hat"},
+    {272, "Shield Striker Helmet"},
+    {273, "Sun Runner Spikes"},
+    {274, "Hot Streak Headpiece"},
+    {275, "Sky Slicer Hat"},
+    {276, "Crypt Crusher Cap"},
+    {277, "Mags Hat"},
+    {278, "Kaos Krown"},
+    {279, "Eon’s Helm"}
 };
 
+constexpr uint16_t nHats = sizeof(hats) / sizeof(hats[0]);
+constexpr uint16_t maxHatCode = hats[nHats - 1].code;
+constexpr uint16_t noHat = 0xFFFF;
+
+constexpr bool hatsSorted() {
+    for (uint16_t i = 1; i < nHats; i++) {
+        if (hats[i].code <= hats[i - 1].code) return false;
+    }
+    return true;
+}
+
+static_assert(hatsSorted(), "The hats table must be in order of code with no duplicates");
+
+/*
+ Code -> hat: just an array indexed by code, holding the index into hats (or noHat)
+ */
+constexpr std::array<uint16_t, maxHatCode + 1> buildCodeIndex() {
+    std::array<uint16_t, maxHatCode + 1> out{};
+    for (uint16_t code = 0; code <= maxHatCode; code++) out[code] = noHat;
+    for (uint16_t i = 0; i < nHats; i++) out[hats[i].code] = i;
+    return out;
+}
+
+constexpr std::array<uint16_t, maxHatCode + 1> codeIndex = buildCodeIndex();
+
+/*
+ Name -> hat: a two level (hash and displace) perfect hash.  The first hash picks a bucket, and each bucket has its own seed for
+ the second hash, chosen at compile time so that every name ends up in its own slot.  So a lookup is two hashes and one string compare.
+ */
+constexpr uint16_t HASH_BUCKETS = 0x80;
+constexpr uint16_t HASH_SLOTS = 0x200;
+constexpr uint8_t MAX_BUCKET_SIZE = 0x10;
+
+constexpr uint32_t hashName(std::string_view name, uint32_t seed) {
+    uint32_t h = 0x811C9DC5 ^ (seed * 0x9E3779B9); //FNV-1a, seeded
+    for (char c : name) {
+        h ^= (uint8_t)c;
+        h *= 0x01000193;
+    }
+    return h ^ (h >> 15);
+}
+
+struct perfectHash {
+    std::array<uint16_t, HASH_BUCKETS> seeds;
+    std::array<uint16_t, HASH_SLOTS> slots; //Index into hats, or noHat
+};
+
+constexpr perfectHash buildPerfectHash() {
+    perfectHash out{};
+    for (uint16_t slot = 0; slot < HASH_SLOTS; slot++) out.slots[slot] = noHat;
+    
+    std::array<uint16_t, nHats> bucketOf{};
+    std::array<uint8_t, HASH_BUCKETS> bucketSize{};
+    for (uint16_t i = 0; i < nHats; i++) {
+        bucketOf[i] = hashName(hats[i].name, 0) % HASH_BUCKETS;
+        if (++bucketSize[bucketOf[i]] > MAX_BUCKET_SIZE) throw "Too many hats in one bucket";
+    }
+    
+    //Place the biggest buckets first, while there is the most room
+    std::array<bool, HASH_BUCKETS> done{};
+    for (uint16_t n = 0; n < HASH_BUCKETS; n++) {
+        uint16_t bucket = 0;
+        for (uint16_t b = 0; b < HASH_BUCKETS; b++) {
+            if (!done[b] && (done[bucket] || bucketSize[b] > bucketSize[bucket])) bucket = b;
+        }
+        done[bucket] = true;
+        if (bucketSize[bucket] == 0) continue;
+        
+        for (uint16_t seed = 1; ; seed++) {
+            if (seed == 0xFFFF) throw "Could not place a bucket of hats";
+            
+            uint16_t members[MAX_BUCKET_SIZE] = {};
+            uint16_t slots[MAX_BUCKET_SIZE] = {};
+            uint8_t nMembers = 0;
+            bool fits = true;
+            
+            for (uint16_t i = 0; i < nHats && fits; i++) {
+                if (bucketOf[i] != bucket) continue;
+                uint16_t slot = hashName(hats[i].name, seed) % HASH_SLOTS;
+                if (out.slots[slot] != noHat) fits = false;
+                for (uint8_t j = 0; j < nMembers; j++) {
+                    if (slots[j] == slot) fits = false;
+                }
+                members[nMembers] = i;
+                slots[nMembers++] = slot;
+            }
+            
+            if (fits) {
+                for (uint8_t j = 0; j < nMembers; j++) out.slots[slots[j]] = members[j];
+                out.seeds[bucket] = seed;
+                break;
+            }
+        }
+    }
+    
+    return out;
+}
+
+constexpr perfectHash nameHash = buildPerfectHash();
+
+}
+
 std::string getHatName(uint16_t code) {
     if (code == 0) return "None";
-    map<uint16_t, string>::iterator it = hatsMap.find(code);
-    if (it == hatsMap.end()) {
-        return "Unknown";
-    } else {
-        return it->second;
-    }
+    if (code > maxHatCode || codeIndex[code] == noHat) return "Unknown";
+    return hats[codeIndex[code]].name;
 }
 
 uint8_t getHatGame(uint16_t code) {
@@ -296,15 +400,26 @@ uint8_t getHatGame(uint16_t code) {
         return 3;
     } else return 4;
 }
-uint16_t getHatCode(std::string hatName) {
-    for (map<uint16_t, string>::iterator it = hatsMap.begin(); it != hatsMap.end(); it++) {
-        if (it->second == hatName) return (it->first);
-    }
-    return 0xFFFF;
-}
-
-        
 
+uint16_t getHatCode(std::string_view hatName) {
+    uint16_t bucket = hashName(hatName, 0) % HASH_BUCKETS;
+    uint16_t index = nameHash.slots[hashName(hatName, nameHash.seeds[bucket]) % HASH_SLOTS];
+    
+    if (index == noHat || hatName != hats[index].name) return 0xFFFF;
+    return hats[index].code;
+}
 
+void getAllHatCodes(std::vector<uint16_t>& destination) {
+    destination.clear();
+    for (uint16_t i = 0; i < nHats; i++) destination.push_back(hats[i].code);
+}
 
+hatStorage getHatStorage(uint16_t code) {
+    uint8_t game = getHatGame(code);
+    return {Locations::hats[game], (uint8_t)(game == 4 ? code - 0xFF : code)};
+}
 
+uint16_t storageToHatCode(uint8_t game, uint8_t value) {
+    if (value == 0) return 0;
+    return (game == 4 ? value + 0xFF : value);
+}
@@ -2,21 +2,52 @@
  Basically just a list of all the hats across the games
  
  hats are identified by a 2 byte code
+ 
+ Each game stores its hat in a different place in the data area (see Locations::hats), and since superchargers hats have codes
+ above 0xFF they are stored with 0xFF subtracted so they still fit into one byte.  getHatStorage/storageToHatCode deal with this so
+ nothing else has to.
+ 
+ All the lookups are done with tables built at compile time - a dense array indexed by code for code -> name, and a perfect hash
+ of the names for name -> code, so nothing has to search through the whole list.
  */
 
 #ifndef HATS_H_GUARD_
 #define HATS_H_GUARD_
 
 #include "misc.h"
-#include <map>
+#include "Locations.h"
 #include <string>
+#include <string_view>
+#include <vector>
+
+struct hatStorage {
+    Locations::dataInfo location; //Where the hat is stored in a data area
+    uint8_t value; //What is actually written there
+};
 
 //Honestly all of these should be mostly self-explanatory
 std::string getHatName(uint16_t code);
 
-uint8_t getHatGame(uint16_t code); //0 spyro -> 5 superchargers
+uint8_t getHatGame(uint16_t code); //0 spyro -> 4 superchargers
+
+uint16_t getHatCode(std::string_view hatName); //currently returns 0xffff if not found
+
+void getAllHatCodes(std::vector<uint16_t>& destination); //Every known hat code, in order
+
+/*
+ getHatStorage: gets where a hat should be stored in a data area, and the value to store there
+ 
+ code: the hat code
+ */
+hatStorage getHatStorage(uint16_t code);
 
-uint16_t getHatCode(std::string hatName); //currently returns 0xffff if not found
+/*
+ storageToHatCode: converts a value read from a game's hat location back to a hat code (0 if no hat)
+ 
+ game: which of Locations::hats the value was read from
+ value: the value read
+ */
+uint16_t storageToHatCode(uint8_t game, uint8_t value);
 
 
 #endif
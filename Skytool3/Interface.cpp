@@ -1,4 +1,15 @@
 #include "Interface.h"
+#include "SerialBaud.h"
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <climits>
+#include <stdlib.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
 
 
 Interface::Interface(std::string portName) : debug(false), portName(portName), baudrate(0), portID(-1) {
@@ -7,15 +18,16 @@ Interface::Interface(std::string portName) : debug(false), portName(portName), b
 	
 void Interface::begin(int baud) {
 			
-	//Convert baudrate
-	if (convertBaud(baud) == -1) {
+	//Convert baudrate - anything without a constant is set afterwards, see SerialBaud.h
+	bool custom = (convertBaud(baud) == -1);
+	if (custom && (baud < CUSTOM_BAUD_MIN || baud > CUSTOM_BAUD_MAX)) {
         throw CodedException(0x03);
 	} else {
-		baudrate = convertBaud(baud);
+		baudrate = custom ? B38400 : convertBaud(baud);
 	}
 	
 
-	int port = open(portName.c_str(), O_RDWR); //Open port
+	int port = open(portName.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK); //Open port, everything waits with poll() instead of blocking
 	
 	if (port < 0) { //Handle errors
    		std::cout << "Error " << errno << " from opening port: " << strerror(errno) << std::endl;
@@ -47,7 +59,7 @@ void Interface::begin(int baud) {
 	tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
 	tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
 	
-	tty.c_cc[VTIME] = 20;    // Wait for up to 2s (20 deciseconds), returning as soon as any data is received.
+	tty.c_cc[VTIME] = 0;    // Never wait in read() - see waitFor
 	tty.c_cc[VMIN] = 0;
 	
 	cfsetispeed(&tty, baudrate); //Set baud rate
@@ -58,7 +70,230 @@ void Interface::begin(int baud) {
         throw CodedException(0x04);
 	}
 	
+	if (custom && !setCustomBaud(port, baud)) {
+		close(port);
+		throw CodedException(0x03);
+	}
+	
 	portID = port;
+	currentBaud = baud;
+	
+	if (lowLatency) tuneLatency();
+}
+
+void Interface::setLowLatency(bool enabled) {
+	lowLatency = enabled;
+}
+
+void Interface::tuneLatency() {
+#ifdef __linux__
+	long before = measureRoundTrip(4);
+	
+	struct serial_struct serial;
+	bool lowLatencySet = false;
+	if (ioctl(portID, TIOCGSERIAL, &serial) == 0) {
+		serial.flags |= ASYNC_LOW_LATENCY;
+		lowLatencySet = (ioctl(portID, TIOCSSERIAL, &serial) == 0);
+	}
+	
+	//The latency timer of an FTDI (and similar) adapter, e.g. /sys/bus/usb-serial/devices/ttyUSB0/latency_timer
+	bool timerSet = false;
+	char resolved[PATH_MAX];
+	if (realpath(portName.c_str(), resolved)) {
+		std::string name(resolved);
+		name = name.substr(name.find_last_of('/') + 1);
+		
+		std::ofstream timer("/sys/bus/usb-serial/devices/" + name + "/latency_timer");
+		if (timer) {
+			timer << 1 << std::endl;
+			timerSet = timer.good();
+		}
+	}
+	
+	long after = (before < 0) ? -1 : measureRoundTrip(8); //Not worth waiting again if nothing answered
+	
+	std::cout << "Serial latency: ASYNC_LOW_LATENCY " << (lowLatencySet ? "on" : "unavailable") << ", latency timer "
+		<< (timerSet ? "set to 1 ms" : "not writable") << ", round trip ";
+	if (before < 0 || after < 0) {
+		std::cout << "not measured (no reply from the adapter yet)" << std::endl;
+	} else {
+		std::cout << std::dec << before << " us -> " << after << " us" << std::endl;
+	}
+#endif
+}
+
+long Interface::measureRoundTrip(uint8_t rounds) {
+	if (portID < 0) throw CodedException(0x05);
+	
+	std::vector<long> times;
+	uint8_t probe = 0x00;
+	uint8_t reply;
+	
+	for (uint8_t i = 0; i < rounds; i++) {
+		buffer[0] = 0x00;
+		buffer[1] = 0xff;
+		buffer[2] = 4;
+		buffer[3] = ~(buffer[2]) + 1;
+		buffer[4] = 1;
+		buffer[5] = 0x00;
+		buffer[6] = INTERFACE_ECHO;
+		buffer[7] = probe;
+		
+		try {
+			startOperation();
+			auto start = std::chrono::steady_clock::now();
+			send(buffer, 8);
+			receive(&reply, 1); //ACK, or NACK from an adapter without INTERFACE_ECHO - either way it is a round trip
+			auto end = std::chrono::steady_clock::now();
+			if (reply == INTERFACE_ACK) receive(&reply, 1); //The echo
+			
+			times.push_back(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+		} catch (const CodedException& e) {
+			return -1;
+		}
+	}
+	
+	if (times.empty()) return -1;
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+int Interface::getBaud() {
+	return currentBaud;
+}
+
+int Interface::negotiateBaud(int maxBaud) {
+	if (portID < 0) throw CodedException(0x05);
+	
+	windowOps = windowErrors = 0;
+	
+	if (!ping()) return currentBaud; //An older adapter that doesn't know the control packets - stay where we are
+	negotiated = true; //Only now, or recordResult would keep sending it control packets it NACKs
+	
+	for (int rate : BAUD_RATES) {
+		if (rate > maxBaud || rate <= currentBaud) continue;
+		if (tryBaud(rate)) break;
+	}
+	
+	if (debug) std::cout << "Agreed on " << std::dec << currentBaud << " baud with the adapter." << std::endl;
+	return currentBaud;
+}
+
+bool Interface::tryBaud(int baud) {
+	int oldBaud = currentBaud;
+	
+	uint8_t rate[4];
+	intToBytes((uint64_t)baud, 4, rate, false);
+	
+	try {
+		startOperation();
+		sendControl(INTERFACE_SET_BAUD, rate, 4);
+	} catch (const CodedException& e) {
+		return false; //Refused, nothing has changed
+	}
+	
+	tcdrain(portID);
+	setHostBaud(baud);
+	std::this_thread::sleep_for(std::chrono::milliseconds(INTERFACE_BAUD_SETTLE_MS));
+	
+	if (ping()) return true;
+	
+	//No good.  The adapter may well have had a good packet at the new rate (e.g. the first echo) and stayed there, so ask it to go
+	//back, at the new rate.  If that doesn't get through either, it never had a good packet and goes back by itself.
+	bool reverted = false;
+	try {
+		intToBytes((uint64_t)oldBaud, 4, rate, false);
+		startOperation();
+		sendControl(INTERFACE_SET_BAUD, rate, 4);
+		tcdrain(portID);
+		reverted = true;
+	} catch (const CodedException& e) {
+		//Same as above
+	}
+	
+	//An ACKed revert starts a new INTERFACE_BAUD_REVERT_MS window at the old rate, so the ping has to get in well before it runs out.
+	//Otherwise wait out the window the adapter started for the new rate.
+	setHostBaud(oldBaud);
+	int wait = reverted ? INTERFACE_BAUD_SETTLE_MS : INTERFACE_BAUD_REVERT_MS + INTERFACE_BAUD_SETTLE_MS;
+	std::this_thread::sleep_for(std::chrono::milliseconds(wait));
+	tcflush(portID, TCIOFLUSH);
+	ringCount = 0;
+	
+	if (!ping()) throw CodedException(0x22);
+	return false;
+}
+
+void Interface::setHostBaud(int baud) {
+	int speed = convertBaud(baud);
+	
+	if (speed == -1) {
+		if (!setCustomBaud(portID, baud)) throw CodedException(0x03);
+	} else {
+		struct termios tty;
+		if (tcgetattr(portID, &tty) != 0) throw CodedException(0x04);
+		cfsetispeed(&tty, speed);
+		cfsetospeed(&tty, speed);
+		if (tcsetattr(portID, TCSANOW, &tty) != 0) throw CodedException(0x04);
+	}
+	
+	currentBaud = baud;
+}
+
+bool Interface::ping() {
+	uint8_t pattern[INTERFACE_PING_LENGTH];
+	uint8_t echo[INTERFACE_PING_LENGTH];
+	
+	for (uint8_t round = 0; round < INTERFACE_PING_ROUNDS; round++) {
+		for (uint8_t i = 0; i < INTERFACE_PING_LENGTH; i++) {
+			pattern[i] = (uint8_t)(i * 0x1D + round * 0x55); //Plenty of bit transitions
+		}
+		
+		try {
+			startOperation();
+			sendControl(INTERFACE_ECHO, pattern, INTERFACE_PING_LENGTH);
+			receive(echo, INTERFACE_PING_LENGTH);
+		} catch (const CodedException& e) {
+			return false;
+		}
+		
+		if (memcmp(echo, pattern, INTERFACE_PING_LENGTH) != 0) return false;
+	}
+	
+	return true;
+}
+
+void Interface::sendControl(uint8_t control, const uint8_t* data, uint8_t nBytes) {
+	if (nBytes > INTERFACE_BUFFER_LENGTH - 7) throw CodedException(0x06);
+	
+	buffer[0] = 0x00;
+	buffer[1] = 0xff;
+	buffer[2] = nBytes + 3;
+	buffer[3] = ~(buffer[2]) + 1;
+	buffer[4] = nBytes;
+	buffer[5] = 0x00; //No I2C address
+	buffer[6] = control;
+	memcpy(buffer + 7, data, nBytes);
+	
+	sendAcknowledge(buffer, nBytes + 7);
+}
+
+void Interface::recordResult(bool ok) {
+	windowOps++;
+	if (!ok) windowErrors++;
+	
+	if (negotiated && windowErrors >= INTERFACE_ERROR_LIMIT) {
+		windowOps = windowErrors = 0;
+		
+		//Step down to the next rate that works
+		for (int rate : BAUD_RATES) {
+			if (rate >= currentBaud) continue;
+			if (tryBaud(rate)) break;
+		}
+		
+		if (debug) std::cout << "Too many errors, dropped to " << std::dec << currentBaud << " baud." << std::endl;
+	}
+	
+	if (windowOps >= INTERFACE_ERROR_WINDOW) windowOps = windowErrors = 0;
 }
 
 
@@ -83,28 +318,77 @@ int Interface::convertBaud(int baud)
 }
 
 void Interface::sendI2C(uint8_t i2caddr, uint8_t* data, uint8_t nBytes) {
+	struct iovec segment;
+	segment.iov_base = data;
+	segment.iov_len = nBytes;
+	
+	sendI2C(i2caddr, &segment, 1);
+}
+
+void Interface::sendI2C(uint8_t i2caddr, const struct iovec* segments, int nSegments) {
+	try {
+		sendPacket(i2caddr, segments, nSegments);
+	} catch (const CodedException& e) {
+		recordResult(false);
+		throw;
+	}
+	recordResult(true);
+}
+
+void Interface::receiveI2C(uint8_t i2caddr, uint8_t* destination, uint8_t nBytes) {
+	try {
+		requestPacket(i2caddr, destination, nBytes);
+	} catch (const CodedException& e) {
+		recordResult(false);
+		throw;
+	}
+	recordResult(true);
+}
+
+void Interface::sendPacket(uint8_t i2caddr, const struct iovec* segments, int nSegments) {
 	if (portID < 0) throw CodedException(0x05);
+	startOperation();
+	if (nSegments > INTERFACE_MAX_SEGMENTS) throw CodedException(0x06);
+	
+	size_t nBytes = 0;
+	for (int i = 0; i < nSegments; i++) {
+		nBytes += segments[i].iov_len;
+	}
 	if (nBytes > INTERFACE_BUFFER_LENGTH - 7) throw CodedException(0x06);
 	
-	buffer[0] = 0x00; //start marker 1
-	buffer[1] = 0xff; //start marker 2
-	buffer[2] = nBytes + 3; //total length of packet
-	buffer[3] = ~(buffer[2]) + 1; // length checksum
-	buffer[4] = nBytes; // length
-	buffer[5] = i2caddr; // i2c address
-	buffer[6] = 0x00; //read
-	std::memcpy(buffer + 7, data, nBytes);
+	uint8_t header[7];
+	header[0] = 0x00; //start marker 1
+	header[1] = 0xff; //start marker 2
+	header[2] = nBytes + 3; //total length of packet
+	header[3] = ~(header[2]) + 1; // length checksum
+	header[4] = nBytes; // length
+	header[5] = i2caddr; // i2c address
+	header[6] = 0x00; //read
+	
+	struct iovec all[INTERFACE_MAX_SEGMENTS + 1];
+	all[0].iov_base = header;
+	all[0].iov_len = 7;
+	for (int i = 0; i < nSegments; i++) {
+		all[i + 1] = segments[i];
+	}
 	
 	if (debug) {
-        std::cout << "Sending " << std::dec << +nBytes << " bytes to I2C address 0x" << std::hex << std::setfill('0') << std::setw(2) << +i2caddr << ": " << std::endl;
-        printHexBytes(data, nBytes, -1);
+        std::cout << "Sending " << std::dec << nBytes << " bytes to I2C address 0x" << std::hex << std::setfill('0') << std::setw(2) << +i2caddr << ": " << std::endl;
+		for (int i = 0; i < nSegments; i++) {
+			printHexBytes((uint8_t*)segments[i].iov_base, segments[i].iov_len, -1);
+		}
 	}
 	
-    sendAcknowledge(buffer, nBytes + 7);
+	sendSegments(all, nSegments + 1);
+	
+	uint8_t response;
+	receive(&response, 1);
+	if (response != INTERFACE_ACK) throw CodedException(0x08);
 }
 
-void Interface::receiveI2C(uint8_t i2caddr, uint8_t* destination, uint8_t nBytes) {
+void Interface::requestPacket(uint8_t i2caddr, uint8_t* destination, uint8_t nBytes) {
     if (portID < 0) throw CodedException(0x05);
+    startOperation();
 
 	buffer[0] = 0x00;
 	buffer[1] = 0xff;
@@ -125,13 +409,132 @@ void Interface::receiveI2C(uint8_t i2caddr, uint8_t* destination, uint8_t nBytes
 
 
 
+bool Interface::supportsBatch() {
+	if (batchSupport >= 0) return batchSupport;
+	if (portID < 0) throw CodedException(0x05);
+	
+	try {
+		runBatch(BridgeBatch());
+		batchSupport = 1;
+	} catch (const CodedException& e) {
+		batchSupport = 0; //NACKed (or no reply)
+	}
+	
+	return batchSupport;
+}
+
+uint8_t Interface::getCapabilities() {
+	if (capabilities >= 0) return capabilities;
+	if (portID < 0) throw CodedException(0x05);
+	
+	try {
+		startOperation();
+		sendControl(INTERFACE_CAPABILITIES, nullptr, 0);
+		
+		uint8_t flags;
+		receive(&flags, 1);
+		capabilities = flags;
+	} catch (const CodedException& e) {
+		capabilities = 0; //NACKed (or no reply)
+	}
+	
+	return capabilities;
+}
+
+void Interface::runBatch(const BridgeBatch& batch) {
+	if (portID < 0) throw CodedException(0x05);
+	
+	bool consumed = false; //Whether the whole reply has been read
+	try {
+		startOperation(batch.waitTime());
+		sendControl(INTERFACE_BATCH, batch.encoded(), batch.encodedLength());
+		
+		uint8_t header[4];
+		receive(header, 4);
+		uint16_t length = (header[0] << 8) | header[1];
+		if (length < 2 || length - 2 > INTERFACE_BUFFER_LENGTH) throw CodedException(0x07);
+		
+		uint8_t results[INTERFACE_BUFFER_LENGTH];
+		receive(results, length - 2);
+		consumed = true;
+		
+		if (header[2] != INTERFACE_BATCH_OK) throw CodedException(0x23);
+		if (length - 2 != batch.replyLength()) throw CodedException(0x07);
+		
+		uint16_t offset = 0;
+		for (uint8_t i = 0; i < batch.readCount(); i++) {
+			memcpy(batch.reads()[i].destination, results + offset, batch.reads()[i].nBytes);
+			offset += batch.reads()[i].nBytes;
+		}
+	} catch (const CodedException& e) {
+		if (!consumed) resync(batch.waitTime());
+		recordResult(false);
+		throw;
+	}
+	recordResult(true);
+}
+
 void Interface::setDebug(bool d) {
 	debug = d;
 }
 
+void Interface::setTimeout(uint32_t millis) {
+	timeout = millis;
+}
+
+void Interface::startOperation(uint32_t extraMillis) {
+	deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout + extraMillis);
+}
+
+void Interface::resync(uint32_t waitMillis) {
+	//First wait for the adapter to finish and start replying, then until it stops
+	deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout + waitMillis);
+	
+	while (waitFor(POLLIN)) {
+		fillRing();
+		ringCount = 0;
+		deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(INTERFACE_RESYNC_QUIET_MS);
+	}
+	
+	tcflush(portID, TCIFLUSH);
+	ringCount = 0;
+}
+
+bool Interface::waitFor(short events) {
+	while (true) {
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (left < 0) return false;
+		
+		struct pollfd p = {portID, events, 0};
+		int n = poll(&p, 1, (int)left + 1);
+		if (n > 0) return true;
+		if (n == 0) return false;
+		if (errno != EINTR) throw CodedException(0x07);
+	}
+}
+
+void Interface::fillRing() {
+	while (ringCount < INTERFACE_BUFFER_LENGTH) {
+		size_t end = (ringStart + ringCount) % INTERFACE_BUFFER_LENGTH;
+		size_t space = std::min(INTERFACE_BUFFER_LENGTH - ringCount, (size_t)INTERFACE_BUFFER_LENGTH - end); //Up to the wrap
+		
+		ssize_t n = read(portID, ring + end, space);
+		if (n > 0) {
+			ringCount += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) throw CodedException(0x07);
+		return; //Nothing more for now
+	}
+}
+
 void Interface::send(uint8_t* data, int nBytes) {
-    if (portID < 0) throw CodedException(0x05);
-	write(portID, data, nBytes);
+	struct iovec segment;
+	segment.iov_base = data;
+	segment.iov_len = nBytes;
+	
+	sendSegments(&segment, 1);
 	
 	if (debug) {
         std::cout << "Sending " << std::dec << nBytes << " bytes:" << std::endl;
@@ -140,16 +543,58 @@ void Interface::send(uint8_t* data, int nBytes) {
 }
 
 
+void Interface::sendSegments(struct iovec* segments, int nSegments) {
+    if (portID < 0) throw CodedException(0x05);
+    
+    while (nSegments > 0) {
+        ssize_t n = writev(portID, segments, nSegments);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (!waitFor(POLLOUT)) throw CodedException(0x1D);
+                continue;
+            }
+            throw CodedException(0x1D);
+        }
+        
+        //Skip whatever was written, a short write leaves the rest for next time
+        while (nSegments > 0 && (size_t)n >= segments->iov_len) {
+            n -= segments->iov_len;
+            segments++;
+            nSegments--;
+        }
+        if (nSegments > 0) {
+            segments->iov_base = (uint8_t*)segments->iov_base + n;
+            segments->iov_len -= n;
+        }
+    }
+}
+
 void Interface::receive(uint8_t* destination, int nBytes) {
     if (portID < 0) throw CodedException(0x05);
-    ssize_t n = read(portID, destination, nBytes);
+    if (nBytes > INTERFACE_BUFFER_LENGTH) throw CodedException(0x06);
+    
+    fillRing();
+    while (ringCount < (size_t)nBytes) {
+        if (!waitFor(POLLIN)) {
+            //Anything that turns up later belongs to this reply, not the next one
+            ringCount = 0;
+            tcflush(portID, TCIFLUSH);
+            throw CodedException(0x07);
+        }
+        fillRing();
+    }
+    
+    for (int i = 0; i < nBytes; i++) {
+        destination[i] = ring[ringStart];
+        ringStart = (ringStart + 1) % INTERFACE_BUFFER_LENGTH;
+    }
+    ringCount -= nBytes;
 
     if (debug) {
-        std::cout << "Received " << std::dec << n << " bytes:" << std::endl;
-        printHexBytes(destination, n, -1);
+        std::cout << "Received " << std::dec << nBytes << " bytes:" << std::endl;
+        printHexBytes(destination, nBytes, -1);
     }
-    
-    if (n != nBytes) throw CodedException(0x07);
 }
 
 
@@ -167,3 +612,116 @@ void Interface::sendAcknowledge(uint8_t* data, int nBytes) {
 }
 
 
+
+
+/*
+*******************************************************************************
+*******************************************************************************
+BATCH**************************************************************************
+*******************************************************************************
+*******************************************************************************
+*/
+
+BridgeBatch& BridgeBatch::write(uint8_t address, const uint8_t* data, uint8_t nBytes) {
+	struct iovec segment;
+	segment.iov_base = (void*)data;
+	segment.iov_len = nBytes;
+	return write(address, &segment, 1);
+}
+
+BridgeBatch& BridgeBatch::write(uint8_t address, const struct iovec* segments, int nSegments) {
+	size_t nBytes = 0;
+	for (int i = 0; i < nSegments; i++) {
+		nBytes += segments[i].iov_len;
+	}
+	if (nBytes > 0xFF) throw CodedException(0x06);
+	
+	uint8_t op[3] = {INTERFACE_OP_WRITE, address, (uint8_t)nBytes};
+	append(op, 3);
+	for (int i = 0; i < nSegments; i++) {
+		append((const uint8_t*)segments[i].iov_base, segments[i].iov_len);
+	}
+	return *this;
+}
+
+BridgeBatch& BridgeBatch::read(uint8_t address, uint8_t* destination, uint8_t nBytes) {
+	if (nReads >= MAX_READS) throw CodedException(0x06);
+	
+	uint8_t op[3] = {INTERFACE_OP_READ, address, nBytes};
+	append(op, 3);
+	targets[nReads].destination = destination;
+	targets[nReads].nBytes = nBytes;
+	nReads++;
+	return *this;
+}
+
+BridgeBatch& BridgeBatch::waitReady(uint8_t address, uint16_t timeoutMillis) {
+	uint8_t op[4] = {INTERFACE_OP_WAIT_READY, address, (uint8_t)(timeoutMillis >> 8), (uint8_t)(timeoutMillis & 0xFF)};
+	append(op, 4);
+	waitMillis += timeoutMillis;
+	return *this;
+}
+
+BridgeBatch& BridgeBatch::mifareRead(uint8_t address, uint16_t timeoutMillis, uint8_t tag, bool isKeyA, const uint8_t key[6],
+                                     const uint8_t uid[4], const uint8_t* blocks, uint8_t nBlocks, uint8_t* status, uint8_t (*destination)[0x10]) {
+	if (nBlocks == 0 || nBlocks > MAX_MIFARE_BLOCKS || nReads + 2 > MAX_READS) throw CodedException(0x06);
+	
+	uint8_t op[6] = {INTERFACE_OP_MIFARE_READ, address, (uint8_t)(timeoutMillis >> 8), (uint8_t)(timeoutMillis & 0xFF), tag,
+		(uint8_t)(isKeyA ? 0x60 : 0x61)};
+	append(op, 6);
+	append(key, 6);
+	append(uid, 4);
+	append(&nBlocks, 1);
+	append(blocks, nBlocks);
+	
+	targets[nReads].destination = status;
+	targets[nReads].nBytes = 1;
+	nReads++;
+	targets[nReads].destination = destination[0];
+	targets[nReads].nBytes = nBlocks * 0x10;
+	nReads++;
+	waitMillis += (uint32_t)(nBlocks + 1) * 2 * timeoutMillis; //ACK and response for the authentication and each block
+	return *this;
+}
+
+BridgeBatch& BridgeBatch::mifareWrite(uint8_t address, uint16_t timeoutMillis, uint8_t tag, bool isKeyA, const uint8_t key[6],
+                                      const uint8_t uid[4], const uint8_t* blocks, uint8_t nBlocks, const uint8_t (*data)[0x10], uint8_t* status) {
+	if (nBlocks == 0 || nBlocks > MAX_MIFARE_BLOCKS || nReads + 1 > MAX_READS) throw CodedException(0x06);
+	
+	uint8_t op[6] = {INTERFACE_OP_MIFARE_WRITE, address, (uint8_t)(timeoutMillis >> 8), (uint8_t)(timeoutMillis & 0xFF), tag,
+		(uint8_t)(isKeyA ? 0x60 : 0x61)};
+	append(op, 6);
+	append(key, 6);
+	append(uid, 4);
+	append(&nBlocks, 1);
+	for (uint8_t i = 0; i < nBlocks; i++) {
+		append(&blocks[i], 1);
+		append(data[i], 0x10);
+	}
+	
+	targets[nReads].destination = status;
+	targets[nReads].nBytes = 1;
+	nReads++;
+	waitMillis += (uint32_t)(nBlocks + 1) * 2 * timeoutMillis;
+	return *this;
+}
+
+void BridgeBatch::clear() {
+	length = 0;
+	nReads = 0;
+	waitMillis = 0;
+}
+
+uint16_t BridgeBatch::replyLength() const {
+	uint16_t total = 0;
+	for (uint8_t i = 0; i < nReads; i++) {
+		total += targets[i].nBytes;
+	}
+	return total;
+}
+
+void BridgeBatch::append(const uint8_t* data, size_t nBytes) {
+	if (length + nBytes > sizeof(ops)) throw CodedException(0x06);
+	memcpy(ops + length, data, nBytes);
+	length += nBytes;
+}
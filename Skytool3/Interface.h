@@ -5,6 +5,9 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <chrono>
 #include "misc.h"
 #include <stdint.h>
 //#include "errorCodes.h"
@@ -13,6 +16,32 @@
 #define INTERFACE_NACK 0x55
 #define INTERFACE_BUFFER_LENGTH 0x100
 
+#define INTERFACE_SET_BAUD 0x02
+#define INTERFACE_ECHO 0x03
+#define INTERFACE_BAUD_REVERT_MS 200
+#define INTERFACE_BAUD_SETTLE_MS 5
+#define INTERFACE_PING_LENGTH 0x20
+#define INTERFACE_PING_ROUNDS 4
+#define INTERFACE_ERROR_WINDOW 64
+#define INTERFACE_ERROR_LIMIT 4
+
+#define INTERFACE_BATCH 0x04
+#define INTERFACE_OP_WRITE 0x00
+#define INTERFACE_OP_READ 0x01
+#define INTERFACE_OP_WAIT_READY 0x02
+#define INTERFACE_BATCH_OK 0x00
+#define INTERFACE_BATCH_TIMEOUT 0x01
+#define INTERFACE_BATCH_I2C_ERROR 0x02
+#define INTERFACE_BATCH_BAD_OP 0x03
+#define INTERFACE_BATCH_FRAME_ERROR 0x04
+#define INTERFACE_RESYNC_QUIET_MS 20
+
+#define INTERFACE_CAPABILITIES 0x05
+#define INTERFACE_CAP_BATCH 0x01
+#define INTERFACE_CAP_MIFARE 0x02
+#define INTERFACE_OP_MIFARE_READ 0x10
+#define INTERFACE_OP_MIFARE_WRITE 0x11
+
 /*
  A class for communicating with peripherals via protocols such as I2C.  Currently it's only used to communicate with
  the PN532 via an intermediary Arduino nano, but this could be extended in future.  
@@ -39,8 +68,97 @@ Host sends:
 	(data)
 	end
 
+Control packets: as above, but with address 0x00 and one of these in place of r/w.  Adapters that don't know them send INTERFACE_NACK.
+	INTERFACE_SET_BAUD: data is the new baud rate (4 bytes, big endian).  The adapter ACKs at the old rate, then switches.  If it
+		doesn't get a good packet at the new rate within INTERFACE_BAUD_REVERT_MS, it goes back to the old rate.  If the link turns out
+		to be bad at the new rate after all, the host sends INTERFACE_SET_BAUD with the old rate (at the new rate) before going back,
+		and pings straight away if that was ACKed, or after INTERFACE_BAUD_REVERT_MS if it wasn't.
+	INTERFACE_ECHO: the adapter ACKs, then sends the data straight back.  Used to check the link (see negotiateBaud).
+	INTERFACE_BATCH: data is a list of I2C operations, carried out in order, with all of the results sent back in one reply (see
+		BridgeBatch).  This makes a whole PN532 command (write, wait, ACK, wait, response) one round trip instead of four.
+	INTERFACE_CAPABILITIES: the adapter ACKs, then sends one byte of flags for the optional parts of the protocol it has:
+		INTERFACE_CAP_BATCH and INTERFACE_CAP_MIFARE (the MIFARE operations below).
+
+Batch operations:
+	INTERFACE_OP_WRITE, address, n, (n bytes)			writes n bytes
+	INTERFACE_OP_READ, address, n						reads n bytes, which go in the reply
+	INTERFACE_OP_WAIT_READY, address, timeout (2 bytes, big endian, ms)
+													reads 1 byte over and over until its bit 0 is set (the PN532 ready status byte)
+
+MIFARE operations (only if the adapter has INTERFACE_CAP_MIFARE).  The adapter builds the PN532 InDataExchange frames itself and
+goes through each one (write, wait, ACK, wait, response) with the given timeout for each wait:
+	INTERFACE_OP_MIFARE_READ, address, timeout (2 bytes), tag, 0x60/0x61 (key A/B), key (6 bytes), UID (4 bytes), n, (n block numbers)
+													authenticates the sector of the first block, then reads the n blocks
+	INTERFACE_OP_MIFARE_WRITE, address, timeout (2 bytes), tag, 0x60/0x61, key (6 bytes), UID (4 bytes), n, n x (block number, 16 bytes)
+													authenticates the sector of the first block, then writes the n blocks
+Both put the PN532 status byte of the first command that failed (0x00 if none did) in the reply, followed for a read by 16 bytes per
+block (zero for blocks that weren't read).  An error from the tag doesn't stop the batch, but a bad ACK or response frame stops it with
+INTERFACE_BATCH_FRAME_ERROR.
+
+Batch reply (after the ACK):
+	Length of what follows (2 bytes, big endian)
+	Status - INTERFACE_BATCH_OK, or why it stopped: INTERFACE_BATCH_TIMEOUT (a wait ran out), INTERFACE_BATCH_I2C_ERROR, or
+		INTERFACE_BATCH_BAD_OP
+	Index of the operation it stopped at (the number of operations if all went well)
+	(the bytes of every read that was done, in order)
+
+A batch with no operations just gets an OK reply, which is how the host checks for support.  BridgeEmulator.h has a reference
+implementation of the adapter side.
+
 */
 
+/*
+ BridgeBatch: builds an INTERFACE_BATCH packet (see above) and keeps track of where each read should go, e.g.
+ 
+    BridgeBatch batch;
+    batch.write(0x24, frame, len).waitReady(0x24, 100).read(0x24, ack, 7);
+    interface->runBatch(batch);
+ */
+class BridgeBatch {
+public:
+    BridgeBatch& write(uint8_t address, const uint8_t* data, uint8_t nBytes);
+    BridgeBatch& write(uint8_t address, const struct iovec* segments, int nSegments); //Segments are joined into one write
+    BridgeBatch& read(uint8_t address, uint8_t* destination, uint8_t nBytes);
+    BridgeBatch& waitReady(uint8_t address, uint16_t timeoutMillis);
+    
+    /*
+     mifareRead/mifareWrite: the MIFARE operations (see above), which authenticate once and then read or write a list of blocks
+     
+     status: destination for the PN532 status byte (0x00 if everything worked)
+     destination: destination for the blocks read, in the order given
+     */
+    BridgeBatch& mifareRead(uint8_t address, uint16_t timeoutMillis, uint8_t tag, bool isKeyA, const uint8_t key[6], const uint8_t uid[4],
+                            const uint8_t* blocks, uint8_t nBlocks, uint8_t* status, uint8_t (*destination)[0x10]);
+    BridgeBatch& mifareWrite(uint8_t address, uint16_t timeoutMillis, uint8_t tag, bool isKeyA, const uint8_t key[6], const uint8_t uid[4],
+                             const uint8_t* blocks, uint8_t nBlocks, const uint8_t (*data)[0x10], uint8_t* status);
+    static constexpr uint8_t MAX_MIFARE_BLOCKS = 0x0C; //So that a write of this many blocks still fits in one packet
+    
+    void clear();
+    
+    const uint8_t* encoded() const { return ops; }
+    uint8_t encodedLength() const { return length; }
+    
+    //Where each read goes, in order
+    struct readTarget {
+        uint8_t* destination;
+        uint8_t nBytes;
+    };
+    static constexpr uint8_t MAX_READS = 8;
+    const readTarget* reads() const { return targets; }
+    uint8_t readCount() const { return nReads; }
+    uint16_t replyLength() const; //Total bytes of read data expected back
+    uint32_t waitTime() const { return waitMillis; } //The longest the adapter could spend waiting for the PN532, in ms
+    
+private:
+    uint8_t ops[INTERFACE_BUFFER_LENGTH - 7];
+    uint8_t length = 0;
+    readTarget targets[MAX_READS];
+    uint8_t nReads = 0;
+    uint32_t waitMillis = 0;
+    
+    void append(const uint8_t* data, size_t nBytes);
+};
+
 class Interface {
 public:
     /*
@@ -58,15 +176,61 @@ public:
     57600
     115200
     230400
+    and anything from CUSTOM_BAUD_MIN to CUSTOM_BAUD_MAX where the OS allows it (see SerialBaud.h), but the adapter has to be at the same
+    rate already - see negotiateBaud to change both together.
      
      */
     void begin(int baud);
     
+    /*
+     setLowLatency: whether begin should tune the port for small request/response packets (on by default).  USB serial adapters
+     normally hold small packets back for up to 16 ms, so begin turns on ASYNC_LOW_LATENCY and sets the adapter's latency timer (if
+     writable) to 1 ms, measuring the round trip to the adapter before and after.  Linux only, elsewhere nothing is changed.
+     
+     Call before begin.
+     */
+    void setLowLatency(bool enabled);
+    
+    /*
+     measureRoundTrip: times a few minimal packets to the adapter and back
+     
+     rounds: number of packets
+     
+     return value: median round trip in microseconds, or -1 if the adapter didn't reply
+     */
+    long measureRoundTrip(uint8_t rounds = 8);
+    static constexpr int CUSTOM_BAUD_MIN = 460800;
+    static constexpr int CUSTOM_BAUD_MAX = 2000000;
+    
+    /*
+     negotiateBaud: moves the link to the highest rate in BAUD_RATES (up to maxBaud) that both ends manage without errors, using the
+     control packets above.  Each rate is checked with a few echo rounds before it is kept, and a failed rate falls back to the old one.
+     
+     After this, if too many operations fail (INTERFACE_ERROR_LIMIT in INTERFACE_ERROR_WINDOW), the link steps down to the next rate
+     by itself.
+     
+     maxBaud: highest rate to try
+     
+     return value: the rate agreed on (unchanged if the adapter doesn't support the control packets)
+     */
+    int negotiateBaud(int maxBaud = CUSTOM_BAUD_MAX);
+    int getBaud();
+    static constexpr int BAUD_RATES[8] = {2000000, 1500000, 1000000, 921600, 500000, 460800, 230400, 115200}; //Fastest first
+    
     /*
      setDebug: specifies whether or not to print debugging messages.
      */
     void setDebug(bool d = true);
     
+    /*
+     setTimeout: the deadline for each sendI2C/receiveI2C, from when it starts.  The port is non-blocking and waited on with poll(), so an
+     operation gives up as soon as this runs out rather than after a fixed serial timeout.
+     
+     millis: time allowed per operation
+     */
+    void setTimeout(uint32_t millis);
+    static constexpr uint32_t DEFAULT_TIMEOUT = 500; //ms
+    
     /*
      sendI2C: Send data to an I2C slave device
      
@@ -76,6 +240,16 @@ public:
      */
     void sendI2C(uint8_t i2caddr, uint8_t* data, uint8_t nBytes);
     
+    /*
+     sendI2C (scatter-gather): as above, but the data is given as a list of segments (e.g. frame header, payload, checksum) which are sent
+     one after the other, behind the bridge header, with a single writev.  Nothing is copied into a buffer first.
+     
+     segments: the pieces of data to send, in order
+     nSegments: number of segments (up to INTERFACE_MAX_SEGMENTS)
+     */
+    void sendI2C(uint8_t i2caddr, const struct iovec* segments, int nSegments);
+    static constexpr int INTERFACE_MAX_SEGMENTS = 7;
+    
     /*
      receiveI2C: Receive data from an I2C slave device
      
@@ -85,6 +259,27 @@ public:
      */
     void receiveI2C(uint8_t i2caddr, uint8_t* destination, uint8_t nBytes);
     
+    /*
+     supportsBatch: whether the adapter understands INTERFACE_BATCH (asked once, then remembered)
+     */
+    bool supportsBatch();
+    
+    /*
+     getCapabilities: the adapter's INTERFACE_CAP flags (asked once with INTERFACE_CAPABILITIES, then remembered).  Adapters that don't
+     know INTERFACE_CAPABILITIES have none.
+     */
+    uint8_t getCapabilities();
+    
+    /*
+     runBatch: sends a batch as one packet and spreads the reply out to the batch's read destinations.  Throws an exception if the
+     adapter couldn't finish it.
+     
+     The timeout is extended by the batch's waitTime, since the adapter only replies once it is done.  If there is no reply in time
+     anyway, the link is resynced (see resync) before the exception is thrown, so it is always safe to send something else afterwards
+     (e.g. an abort to the PN532).
+     */
+    void runBatch(const BridgeBatch& batch);
+    
 private:
     std::string portName; //Name of the device to write to, e.g. "/dev/cu.usbserial-AR0KL3OY"
     int portID; //handle for writing to the device
@@ -92,6 +287,84 @@ private:
     bool debug; //Whether debug messages should be printed
     uint8_t buffer[INTERFACE_BUFFER_LENGTH]; //Buffer for storing I2C data in/out
     
+    uint32_t timeout = DEFAULT_TIMEOUT; //ms, see setTimeout
+    bool lowLatency = true; //See setLowLatency
+    int8_t batchSupport = -1; //-1 until asked, see supportsBatch
+    int16_t capabilities = -1; //-1 until asked, see getCapabilities
+    int currentBaud = 0; //The actual rate (baudrate is the B constant it started with)
+    bool negotiated = false; //Whether to fall back on errors, see negotiateBaud
+    uint16_t windowOps = 0;
+    uint16_t windowErrors = 0;
+    std::chrono::steady_clock::time_point deadline; //Of the current operation
+    
+    //Bytes read from the port but not asked for yet - the adapter's USB packets don't line up with what was asked for
+    uint8_t ring[INTERFACE_BUFFER_LENGTH];
+    size_t ringStart = 0;
+    size_t ringCount = 0;
+    
+    /*
+     sendPacket/requestPacket: sendI2C/receiveI2C, without keeping track of errors
+     */
+    void sendPacket(uint8_t i2caddr, const struct iovec* segments, int nSegments);
+    void requestPacket(uint8_t i2caddr, uint8_t* destination, uint8_t nBytes);
+    
+    /*
+     sendControl: sends a control packet (see the protocol above) and waits for the ACK
+     */
+    void sendControl(uint8_t control, const uint8_t* data, uint8_t nBytes);
+    
+    /*
+     tryBaud: asks the adapter to switch to a rate, follows it, and checks the link.  Goes back to the old rate (both ends) if it
+     doesn't work.
+     
+     return value: whether the link is now at the new rate
+     */
+    bool tryBaud(int baud);
+    void setHostBaud(int baud);
+    
+    /*
+     ping: sends a few rounds of a test pattern with INTERFACE_ECHO and checks they come back unchanged
+     */
+    bool ping();
+    
+    /*
+     recordResult: counts successful and failed operations, and steps the rate down if too many fail (see negotiateBaud)
+     */
+    void recordResult(bool ok);
+    
+    /*
+     tuneLatency: turns on ASYNC_LOW_LATENCY and lowers the USB latency timer, see setLowLatency
+     */
+    void tuneLatency();
+    
+    /*
+     startOperation: sets the deadline for a new sendI2C/receiveI2C
+     
+     extraMillis: added to the timeout, for operations where the adapter itself waits (see runBatch)
+     */
+    void startOperation(uint32_t extraMillis = 0);
+    
+    /*
+     resync: after a reply that didn't arrive in time, waits for whatever the adapter still sends (up to waitMillis plus the timeout)
+     and throws it away, until the port has been quiet for INTERFACE_RESYNC_QUIET_MS.  Then the next packet's reply can't be confused
+     with the late one.
+     */
+    void resync(uint32_t waitMillis);
+    
+    /*
+     waitFor: waits with poll() until the port is readable/writable or the deadline passes
+     
+     events: POLLIN or POLLOUT
+     
+     return value: false if the deadline passed
+     */
+    bool waitFor(short events);
+    
+    /*
+     fillRing: reads whatever is available from the port into the ring buffer
+     */
+    void fillRing();
+    
     /*
      send: Send data to the adapter device
      
@@ -101,7 +374,17 @@ private:
     void send(uint8_t* data, int nBytes);
     
     /*
-     Receive: Receive data from the adapter device
+     sendSegments: Send several pieces of data to the adapter device in one writev, carrying on after short writes (waiting for the port
+     to be writable again, up to the deadline)
+     
+     segments: the pieces of data (modified as they are sent)
+     nSegments: number of segments
+     */
+    void sendSegments(struct iovec* segments, int nSegments);
+    
+    /*
+     Receive: Receive data from the adapter device, collecting it from as many reads as it takes, up to the deadline.  On a timeout any
+     leftover input is thrown away, so a late reply can't be mistaken for the next one.
      
      data: pointer to array of bytes to receive
      nBytes: number of bytes to receive
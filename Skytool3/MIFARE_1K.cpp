@@ -1,4 +1,7 @@
 #include "MIFARE_1K.h"
+#include <thread>
+#include <chrono>
+#include <algorithm>
 
 
 /*
@@ -10,25 +13,27 @@ CONSTRUCTORS*******************************************************************
 */
 
 MIFARE_1K::MIFARE_1K() {
+    makeImage();
     setDefault();
 	paramsToData();
 }
 
 MIFARE_1K::MIFARE_1K(const char* filename) {
+    makeImage();
 	readFile(filename, &data[0][0], 0x400);
 	dataToParams(); //Copy in all the keys, UID, etc. to their own variables
-	memset(altered, 0x00, 0x40);
 }
 
 MIFARE_1K::MIFARE_1K(const uint8_t dataIn[0x40][0x10]) {
+    makeImage();
     for (uint8_t block = 0; block < 0x40; block++) {
         memcpy(data[block], dataIn[block], 0x10);
     }
     dataToParams(); //Copy in all the keys, UID, etc. to their own variables
-    memset(altered, 0x00, 0x40);
 }
 
 MIFARE_1K::MIFARE_1K(PN532* pn532) {
+    makeImage();
     setDefault();
     pn532->SAMConfig();
     pn532->detectMifare1K(UID);
@@ -36,6 +41,52 @@ MIFARE_1K::MIFARE_1K(PN532* pn532) {
     calcBCC();
 }
 
+MIFARE_1K::MIFARE_1K(const uint8_t uid[0x04], uint8_t _tag) : tag(_tag) {
+    makeImage();
+    setDefault();
+    memcpy(UID, uid, 0x04);
+    memcpy(data[0x00], UID, 0x04);
+    calcBCC();
+}
+
+MIFARE_1K::MIFARE_1K(FigureImage* view) : image(view), data(view->data) {
+    isMagic = false;
+    dataToParams();
+}
+
+MIFARE_1K::MIFARE_1K(const MIFARE_1K& other) {
+    *this = other;
+}
+
+MIFARE_1K& MIFARE_1K::operator=(const MIFARE_1K& other) {
+    if (this == &other) return *this;
+    
+    isMagic = other.isMagic;
+    isGen1a = other.isGen1a;
+    tag = other.tag;
+    memcpy(keysA, other.keysA, sizeof(keysA));
+    memcpy(keysB, other.keysB, sizeof(keysB));
+    memcpy(accessBits, other.accessBits, sizeof(accessBits));
+    memcpy(spareBytes, other.spareBytes, sizeof(spareBytes));
+    memcpy(UID, other.UID, sizeof(UID));
+    
+    if (other.ownImage) {
+        if (!ownImage) makeImage();
+        *ownImage = *other.ownImage;
+    } else {
+        ownImage.reset();
+        image = other.image;
+        data = image->data;
+    }
+    return *this;
+}
+
+void MIFARE_1K::makeImage() {
+    ownImage.reset(new FigureImage());
+    image = ownImage.get();
+    data = image->data;
+}
+
 /*
 *******************************************************************************
 *******************************************************************************
@@ -48,7 +99,7 @@ void MIFARE_1K::setDefault() {
     isMagic = false;
     memset(UID, 0x00, 0x04);
     memset(data, 0x00, 0x400); //Clear data
-    memset(altered, 0x00, 0x40);
+    image->clearAltered();
     memcpy(&data[0][5], defaultZero, 0x0B);
     for (uint8_t sector = 0; sector < 0x10; sector++) {
         setKeyA(sector, defaultKey);
@@ -143,6 +194,18 @@ void MIFARE_1K::getRawData(uint8_t destination[0x400]) {
     memcpy(destination, data, 0x400);
 }
 
+FigureImage* MIFARE_1K::getImage() {
+    return image;
+}
+
+uint8_t MIFARE_1K::getTag() {
+    return tag;
+}
+
+void MIFARE_1K::setTag(uint8_t newTag) {
+    tag = newTag;
+}
+
 /*
 *******************************************************************************
 *******************************************************************************
@@ -153,8 +216,66 @@ AUTHENTICATION*****************************************************************
 
 
 void MIFARE_1K::authenticate(PN532* pn532, uint8_t sector, bool keyA) {
+    tryAuthenticate(pn532, sector, keyA).orThrow();
+}
+
+PN532::Status MIFARE_1K::tryAuthenticate(PN532* pn532, uint8_t sector, bool keyA) {
     if (!isValidSector(sector)) throw CodedException(0x0B);
-    pn532->MifareClassic_AuthenticateBlock(MIFARE_1K::sectorToBlock(sector) - 3, UID, keyA, keysA[sector]);
+    return pn532->tryMifareClassic_AuthenticateBlock(MIFARE_1K::sectorToBlock(sector) - 3, UID, keyA, keyA ? keysA[sector] : keysB[sector], tag);
+}
+
+bool MIFARE_1K::authenticateFor(PN532* pn532, uint8_t block, bool write) {
+    bool keyA = chooseKey(block, write);
+    authenticate(pn532, blockToSector(block), keyA); //Does nothing if this sector and key are already authenticated
+    return keyA;
+}
+
+bool MIFARE_1K::chooseKey(uint8_t block, bool write) {
+    uint8_t keys = allowedKeys(block, write);
+    if (keys == KEY_NONE) throw CodedException(0x18);
+    return (keys & KEY_A); //Key A if it will do, since that's the one most likely to be known
+}
+
+uint8_t MIFARE_1K::allowedKeys(uint8_t block, bool write) {
+    if (!isValidBlock(block)) throw CodedException(0x0B);
+    uint8_t sector = blockToSector(block);
+    
+    //If the access bits aren't valid then they aren't known (e.g. never read), so let the card decide
+    if (!validAccessBits(accessBits[sector])) return KEY_AB;
+    
+    uint8_t keys;
+    const trailerAccess& trailer = trailerAccessTable[accessConditions(accessBits[sector], 3)];
+    
+    if (isTrailerBlock(block)) {
+        if (!write) {
+            keys = trailer.readAccessBits;
+        } else if (trailer.writeAccessBits != KEY_NONE) {
+            keys = trailer.writeAccessBits;
+        } else {
+            keys = trailer.writeKeyA | trailer.writeKeyB; //Only the keys can change
+        }
+    } else {
+        const dataAccess& access = dataAccessTable[accessConditions(accessBits[sector], block % 4)];
+        keys = write ? access.write : access.read;
+    }
+    
+    //A readable key B is treated as data, and can't be used to authenticate
+    if (trailer.readKeyB != KEY_NONE) keys &= ~KEY_B;
+    
+    return keys;
+}
+
+uint8_t MIFARE_1K::accessConditions(const uint8_t bits[0x03], uint8_t blockInSector) {
+    //C1 is in byte 7 (high nibble), C2 and C3 are in byte 8 (low and high nibble)
+    return (readBit(bits[1], 4 + blockInSector) << 2) | (readBit(bits[2], blockInSector) << 1) | readBit(bits[2], 4 + blockInSector);
+}
+
+bool MIFARE_1K::validAccessBits(const uint8_t bits[0x03]) {
+    //Byte 6 holds the inverses of C1 and C2, and byte 7 low nibble the inverse of C3
+    uint8_t c1 = bits[1] >> 4, c2 = bits[2] & 0x0F, c3 = bits[2] >> 4;
+    uint8_t notC1 = bits[0] & 0x0F, notC2 = bits[0] >> 4, notC3 = bits[1] & 0x0F;
+    
+    return ((c1 ^ notC1) == 0x0F && (c2 ^ notC2) == 0x0F && (c3 ^ notC3) == 0x0F);
 }
 
 
@@ -166,45 +287,273 @@ READ/WRITE*********************************************************************
 *******************************************************************************
 */
 
-void MIFARE_1K::updateSector(PN532* pn532, uint8_t sector, bool keyA) {
+void MIFARE_1K::updateSector(PN532* pn532, uint8_t sector) {
     if (!isValidSector(sector)) throw CodedException(0x0B);
-	bool authenticated = false;
 	
+	//Check everything first, so nothing is sent if any block can't be written
 	for (uint8_t block = MIFARE_1K::sectorToBlock(sector)-3; block < MIFARE_1K::sectorToBlock(sector); block++) {
-		if (altered[block]) {
-			if (!authenticated) {
-                authenticate(pn532, sector, keyA);
-				authenticated = true;
-			}
-			pn532->MifareClassic_WriteBlock(block, data[block]);
-            altered[block] = false;
+		if (image->isAltered(block)) chooseKey(block, true);
+	}
+	
+    uint8_t altered = alteredBlocks(sector);
+    bool keyA;
+    if (altered && atOnceKey(pn532, sector, altered, true, &keyA)) {
+        tryWriteAtOnce(pn532, sector, altered, keyA).orThrow();
+        for (uint8_t block = MIFARE_1K::sectorToBlock(sector)-3; block < MIFARE_1K::sectorToBlock(sector); block++) {
+            image->clearAltered(block);
+        }
+        return;
+    }
+	
+	for (uint8_t block = MIFARE_1K::sectorToBlock(sector)-3; block < MIFARE_1K::sectorToBlock(sector); block++) {
+		if (image->isAltered(block)) {
+            authenticateFor(pn532, block, true);
+			pn532->MifareClassic_WriteBlock(block, data[block], tag);
+            image->clearAltered(block);
 		}
 	}
 }
 
-void MIFARE_1K::update(PN532* pn532, bool keyA) {
+void MIFARE_1K::update(PN532* pn532) {
 	for (uint8_t sector = 0; sector < 0x10; sector++) {
-        updateSector(pn532, sector, keyA);
+        updateSector(pn532, sector);
 	}
 }
 
-void MIFARE_1K::read(PN532* pn532, bool keyA) {
-	for (uint8_t sector = 0; sector < 0x10; sector++) {
-        readSector(pn532, sector, keyA);
-	}
+void MIFARE_1K::updateSector(PN532* pn532, uint8_t sector, verifyReport& report) {
+    if (!isValidSector(sector)) throw CodedException(0x0B);
+    
+    uint8_t trailer = MIFARE_1K::sectorToBlock(sector);
+    
+    //Check everything first, reading back needs to be allowed too
+    for (uint8_t block = trailer - 3; block < trailer; block++) {
+        if (image->isAltered(block)) {
+            chooseKey(block, true);
+            chooseKey(block, false);
+        }
+    }
+    
+    uint8_t altered = alteredBlocks(sector);
+    if (altered == 0) return;
+    
+    bool keyA;
+    if (atOnceKey(pn532, sector, altered, true, &keyA)) {
+        tryWriteAtOnce(pn532, sector, altered, keyA).orThrow();
+    } else {
+        for (uint8_t block = trailer - 3; block < trailer; block++) {
+            if (image->isAltered(block)) {
+                authenticateFor(pn532, block, true);
+                pn532->MifareClassic_WriteBlock(block, data[block], tag);
+            }
+        }
+    }
+    
+    //Read back (same authentication unless reading needs the other key).  Blocks read back in one go that match are done, the rest
+    //go through the loop below.
+    uint8_t readBack[0x10];
+    uint8_t matched = 0;
+    uint8_t sectorReadBack[0x04][0x10];
+    if (atOnceKey(pn532, sector, altered, false, &keyA) && tryReadAtOnce(pn532, sector, altered, keyA, sectorReadBack)) {
+        for (uint8_t i = 0; i < 0x03; i++) {
+            if (readBit(altered, i) && memcmp(sectorReadBack[i], data[trailer - 3 + i], 0x10) == 0) matched |= (1 << i);
+        }
+    }
+    
+    for (uint8_t block = trailer - 3; block < trailer; block++) {
+        if (!readBit(altered, block - (trailer - 3))) continue;
+        if (readBit(matched, block - (trailer - 3))) {
+            image->clearAltered(block);
+            continue;
+        }
+        
+        for (uint8_t attempt = 0; ; attempt++) {
+            authenticateFor(pn532, block, false);
+            pn532->MifareClassic_ReadBlock(block, readBack, tag);
+            if (memcmp(readBack, data[block], 0x10) == 0) break;
+            
+            report.mismatched |= (1ULL << block);
+            if (attempt >= MAX_REWRITES) throw CodedException(0x1C);
+            
+            authenticateFor(pn532, block, true);
+            pn532->MifareClassic_WriteBlock(block, data[block], tag);
+            report.rewrites++;
+        }
+        
+        image->clearAltered(block);
+    }
+}
+
+void MIFARE_1K::update(PN532* pn532, verifyReport& report) {
+    for (uint8_t sector = 0; sector < 0x10; sector++) {
+        updateSector(pn532, sector, report);
+    }
+}
+
+void MIFARE_1K::update(PN532* pn532, WriteJournal& journal) {
+    std::vector<blockWrite> plan;
+    uint8_t before[0x40][0x10];
+    
+    for (uint8_t block = 0; block < 0x40; block++) {
+        if (!image->isAltered(block)) continue;
+        
+        authenticateFor(pn532, block, false);
+        pn532->MifareClassic_ReadBlock(block, before[block], tag);
+        
+        blockWrite write;
+        write.block = block;
+        memcpy(write.data, data[block], 0x10);
+        plan.push_back(write);
+    }
+    
+    writePlan(pn532, plan, &journal, before);
+}
+
+void MIFARE_1K::read(PN532* pn532) {
+    readProgress progress;
+    readResumable(pn532, ~0ULL, progress);
+}
+
+void MIFARE_1K::readResumable(PN532* pn532, uint64_t blocks, readProgress& progress, const retryPolicy& policy) {
+    for (uint8_t block = 0; block < 0x40; block++) {
+        if (!((blocks >> block) & 0x01) || ((progress.done >> block) & 0x01)) continue;
+        
+        //A whole sector still to read goes to the adapter in one go if it can - if that fails, the blocks are retried one at a time
+        bool keyA;
+        if (isFirstBlock(block) && ((blocks >> block) & 0x0F) == 0x0F && ((progress.done >> block) & 0x0F) == 0 &&
+            atOnceKey(pn532, blockToSector(block), 0x0F, false, &keyA) &&
+            tryReadAtOnce(pn532, blockToSector(block), 0x0F, keyA, &data[block])) {
+            fillTrailer(block + 3);
+            progress.done |= (0x0FULL << block);
+            block += 3;
+            continue;
+        }
+        
+        uint16_t backoff = policy.initialBackoff;
+        
+        for (uint8_t attempt = 0; ; attempt++) {
+            PN532::Status status = tryAuthenticate(pn532, blockToSector(block), chooseKey(block, false));
+            if (status) status = pn532->tryMifareClassic_ReadBlock(block, data[block], tag);
+            if (status) break;
+            
+            if (!isRetryable(status.code) || attempt >= policy.maxRetries) status.orThrow();
+            
+            progress.retries[block]++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+            backoff = std::min<uint16_t>(backoff * 2, policy.maxBackoff);
+            
+            try {
+                reselect(pn532);
+            } catch (const PN532::PN532Exception& e) {
+                if (!isRetryable(e.code)) throw; //Otherwise just try the block again, which will fail and come back here
+            } catch (const CodedException& e) {
+                if (e.getCode() == 0x1A) throw; //A different figure - retrying won't help
+                //Otherwise a hiccup on the link - same as above
+            }
+        }
+        
+        if (isTrailerBlock(block)) fillTrailer(block);
+        
+        progress.done |= (1ULL << block);
+    }
 }
 
-void MIFARE_1K::readSector(PN532* pn532, uint8_t sector, bool keyA) {
+void MIFARE_1K::readSector(PN532* pn532, uint8_t sector) {
     if (!MIFARE_1K::isValidSector(sector)) throw CodedException(0x0B);
 	
-    authenticate(pn532, sector, keyA);
-    
     uint8_t block = sectorToBlock(sector) - 3;
-	for (; block <= MIFARE_1K::sectorToBlock(sector); block++) {
-		pn532->MifareClassic_ReadBlock(block, data[block]);
-	}
+    bool keyA;
+    if (atOnceKey(pn532, sector, 0x0F, false, &keyA)) {
+        tryReadAtOnce(pn532, sector, 0x0F, keyA, &data[block]).orThrow();
+    } else {
+        for (; block <= MIFARE_1K::sectorToBlock(sector); block++) {
+            authenticateFor(pn532, block, false);
+            pn532->MifareClassic_ReadBlock(block, data[block], tag);
+        }
+    }
 	
-	getKeyA(sector, &data[block-1][0]); //Because the keys are hidden when read - since we know the key, we can copy it in
+	fillTrailer(MIFARE_1K::sectorToBlock(sector));
+}
+
+void MIFARE_1K::readPair(PN532* pn532, MIFARE_1K& first, MIFARE_1K& second) {
+    for (uint8_t sector = 0; sector < 0x10; sector++) {
+        first.readSector(pn532, sector);
+        second.readSector(pn532, sector);
+    }
+}
+
+void MIFARE_1K::readBlocks(PN532* pn532, uint64_t blocks) {
+    for (uint8_t sector = 0; sector < 0x10; sector++) {
+        uint8_t trailer = sectorToBlock(sector);
+        uint64_t sectorBlocks = (blocks >> (trailer - 3)) & 0x07; //Just the three data blocks
+        if (sectorBlocks == 0) continue;
+        
+        for (uint8_t block = trailer - 3; block < trailer; block++) {
+            if (readBit(sectorBlocks, block - (trailer - 3))) {
+                authenticateFor(pn532, block, false);
+                pn532->MifareClassic_ReadBlock(block, data[block], tag);
+            }
+        }
+    }
+}
+
+bool MIFARE_1K::atOnceKey(PN532* pn532, uint8_t sector, uint8_t blocks, bool write, bool* keyA) {
+    uint8_t keys = KEY_AB;
+    for (uint8_t i = 0; i < 0x04; i++) {
+        if (readBit(blocks, i)) keys &= allowedKeys(sectorToBlock(sector) - 3 + i, write);
+    }
+    if (keys == KEY_NONE || !pn532->supportsMifareMacros()) return false;
+    
+    *keyA = (keys & KEY_A);
+    return true;
+}
+
+PN532::Status MIFARE_1K::tryReadAtOnce(PN532* pn532, uint8_t sector, uint8_t blocks, bool keyA, uint8_t destination[0x04][0x10]) {
+    uint8_t first = sectorToBlock(sector) - 3;
+    uint8_t list[0x04];
+    uint8_t received[0x04][0x10];
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < 0x04; i++) {
+        if (readBit(blocks, i)) list[n++] = first + i;
+    }
+    
+    PN532::Status status = pn532->tryMifareClassic_AuthenticateAndRead(list, n, UID, keyA, keyA ? keysA[sector] : keysB[sector], received, tag);
+    if (!status) return status;
+    
+    for (uint8_t i = 0; i < n; i++) {
+        memcpy(destination[list[i] - first], received[i], 0x10);
+    }
+    return status;
+}
+
+PN532::Status MIFARE_1K::tryWriteAtOnce(PN532* pn532, uint8_t sector, uint8_t blocks, bool keyA) {
+    uint8_t first = sectorToBlock(sector) - 3;
+    uint8_t list[0x04];
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < 0x04; i++) {
+        if (readBit(blocks, i)) list[n++] = first + i;
+    }
+    
+    uint8_t toWrite[0x04][0x10];
+    for (uint8_t i = 0; i < n; i++) {
+        memcpy(toWrite[i], data[list[i]], 0x10);
+    }
+    
+    return pn532->tryMifareClassic_AuthenticateAndWrite(list, n, toWrite, UID, keyA, keyA ? keysA[sector] : keysB[sector], tag);
+}
+
+uint8_t MIFARE_1K::alteredBlocks(uint8_t sector) {
+    uint8_t blocks = 0;
+    for (uint8_t i = 0; i < 0x03; i++) {
+        if (image->isAltered(sectorToBlock(sector) - 3 + i)) blocks |= (1 << i);
+    }
+    return blocks;
+}
+
+void MIFARE_1K::fillTrailer(uint8_t block) {
+    uint8_t sector = blockToSector(block);
+    getKeyA(sector, &data[block][0]); //Because the keys are hidden when read - since we know the key, we can copy it in
+    setAccessBits(sector, &data[block][0x06]); //The access bits can always be read, so now they're known
+    setSpareByte(sector, &data[block][0x09]);
 }
 
 /*
@@ -222,8 +571,8 @@ void MIFARE_1K::changeKeyA(PN532* pn532, uint8_t sector, const uint8_t newKey[0x
     getBlock(block, newTrailer);
 	memcpy(newTrailer, newKey, 0x06);
 	
-    authenticate(pn532, sector, true);
-    pn532->MifareClassic_WriteBlock(block, newTrailer);
+    authenticateFor(pn532, block, true);
+    pn532->MifareClassic_WriteBlock(block, newTrailer, tag);
 	
 	memcpy(data[block], newTrailer, 0x10);
 	setKeyA(sector, newKey);
@@ -236,22 +585,23 @@ void MIFARE_1K::changeKeyB(PN532* pn532, uint8_t sector, uint8_t const newKey[0x
     getBlock(block, newTrailer);
     memcpy(newTrailer + 0x0A, newKey, 0x06);
     
-    authenticate(pn532, sector, false);
-    pn532->MifareClassic_WriteBlock(block, newTrailer);
+    authenticateFor(pn532, block, true);
+    pn532->MifareClassic_WriteBlock(block, newTrailer, tag);
     
     memcpy(data[block], newTrailer, 0x10);
     setKeyB(sector, newKey);
 }
 
-void MIFARE_1K::changeAccessBits(PN532* pn532, uint8_t sector, const uint8_t newBits[0x03], bool keyA) {
+void MIFARE_1K::changeAccessBits(PN532* pn532, uint8_t sector, const uint8_t newBits[0x03]) {
     if (!MIFARE_1K::isValidSector(sector)) throw CodedException(0x0B);
+    if (!validAccessBits(newBits)) throw CodedException(0x19); //This would make the sector unusable
 	uint8_t newTrailer[0x10];
 	uint8_t block = MIFARE_1K::sectorToBlock(sector);
     getBlock(block, newTrailer);
 	memcpy(newTrailer + 0x06, newBits, 0x03);
 	
-    authenticate(pn532, sector, keyA);
-    pn532->MifareClassic_WriteBlock(block, newTrailer);
+    authenticateFor(pn532, block, true);
+    pn532->MifareClassic_WriteBlock(block, newTrailer, tag);
     
 	memcpy(data[block], newTrailer, 0x10);
 	setAccessBits(sector, newBits);
@@ -265,14 +615,17 @@ MAGIC FUNCTIONS****************************************************************
 *******************************************************************************
 */
 
-void MIFARE_1K::changeBlockZero(PN532* pn532, const uint8_t newBlock[0x10], bool keyA) {
+void MIFARE_1K::changeBlockZero(PN532* pn532, const uint8_t newBlock[0x10]) {
     if (!isMagic) throw CodedException(0x0C);
-    setBlock(0x00, newBlock);
-    updateSector(pn532, 0x00, keyA);
-    memcpy(UID, &data[0][0], 4);
+    
+    std::vector<blockWrite> plan(1);
+    plan[0].block = 0x00;
+    memcpy(plan[0].data, newBlock, 0x10);
+    
+    writePlan(pn532, plan); //Also updates UID
 }
 
-void MIFARE_1K::changeUID(PN532* pn532, const uint8_t newUID[0x04], bool keyA) {
+void MIFARE_1K::changeUID(PN532* pn532, const uint8_t newUID[0x04]) {
     if (!isMagic) throw CodedException(0x0C);
     
     std::cout << "Printing old UID in case something goes wrong: " << std::endl;
@@ -281,39 +634,115 @@ void MIFARE_1K::changeUID(PN532* pn532, const uint8_t newUID[0x04], bool keyA) {
     uint8_t newBlock[0x10];
     getBlock(0x00, newBlock); //get old block zero
     memcpy(newBlock, newUID, 0x04); //put in new uid
+    newBlock[4] = newBlock[0] ^ newBlock[1] ^ newBlock[2] ^ newBlock[3]; //and fix BCC
     
-    setBlock(0x00, newBlock); //write back
-    calcBCC(); //and fix BCC
-    
-    updateSector(pn532, 0x00, keyA);
+    changeBlockZero(pn532, newBlock);
 }
 
 void MIFARE_1K::flagMagic() {
 	isMagic = true;
 }
 
-void MIFARE_1K::clone(PN532* pn532, const uint8_t dataIn[0x40][0x10]) {
-    //Loop over every block
-    for (uint8_t block = 1; block < 0x40; block++) {
-        if (MIFARE_1K::isDataBlock(block)) {
-            //write the new data (not to physical card) and mark that block for update
-            setBlock(block, dataIn[block]);
-            flag(block);
+void MIFARE_1K::reselect(PN532* pn532) {
+    uint8_t uids[2][0x04];
+    uint8_t tags[2];
+    uint8_t found = pn532->detectTags(uids, tags);
+    
+    for (uint8_t i = 0; i < found; i++) {
+        if (memcmp(uids[i], UID, 0x04) == 0) {
+            tag = tags[i]; //The numbering can change if the other tag has gone
+            return;
+        }
+    }
+    
+    if (found == 0) throw PN532::PN532Exception(0x01); //Nothing there (yet), same as a timeout
+    throw CodedException(0x1A);
+}
+
+bool MIFARE_1K::isRetryable(uint8_t code) {
+    switch (code) {
+        case 0x01: //Timeout
+        case 0x02: //CRC
+        case 0x03: //Parity
+        case 0x05: //Framing
+        case 0x13: //Bad frame
+        case 0x14: //Authentication - a marginal link can garble this too
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool MIFARE_1K::detectGen1a(PN532* pn532) {
+    if (unlockGen1a(pn532)) {
+        isGen1a = true;
+        isMagic = true;
+    }
+    return isGen1a;
+}
+
+bool MIFARE_1K::unlockGen1a(PN532* pn532) {
+    static const uint8_t halt[4] = {0x50, 0x00, 0x57, 0xCD}; //HALT with its CRC, since the CRC is turned off
+    static const uint8_t unlock1 = 0x40; //Sent as 7 bits
+    static const uint8_t unlock2 = 0x43;
+    uint8_t response = 0;
+    bool unlocked = false;
+    
+    pn532->select(tag); //Raw frames go to whichever tag is selected
+    pn532->setCRC(false);
+    
+    try {
+        try {
+            pn532->communicateThru(halt, 4, &response, 0);
+        } catch (const PN532::PN532Exception& e) {
+            if (e.code != 0x01) throw; //A halted card doesn't answer, so a timeout is expected
         }
+        
+        pn532->setLastBits(7);
+        pn532->communicateThru(&unlock1, 1, &response, 1);
+        pn532->setLastBits(0);
+        
+        if (response == 0x0A) {
+            pn532->communicateThru(&unlock2, 1, &response, 1);
+            unlocked = (response == 0x0A);
+        }
+    } catch (const PN532::PN532Exception& e) {
+        unlocked = false; //Not gen1a - a normal card just doesn't answer
     }
     
-    update(pn532, true); //Update with key A since this is the factory default best key
+    pn532->setLastBits(0);
+    pn532->setCRC(true);
     
-    //Change UID first - in case block zero will be read only
+    if (!unlocked) wakeUp(pn532); //Otherwise it is left halted, and nothing else would get an answer from it
     
-    changeBlockZero(pn532, dataIn[0x00], true);
+    return unlocked;
+}
+
+void MIFARE_1K::wakeUp(PN532* pn532) {
+    static const uint8_t wupa = 0x52; //Sent as 7 bits
+    uint8_t response[2];
     
-    //This step must be done last, e.g. if we wanted to clone a card that was read only - write the data first and THEN set it to read only
-    for (int sector = 0; sector < 0x10; sector++) {
-        changeKeyB(pn532, sector, &data[sectorToBlock(sector)][0x0A]);
-        changeKeyA(pn532, sector, data[sectorToBlock(sector)]);
-        changeAccessBits(pn532, sector, &data[sectorToBlock(sector)][0x06], true);
+    pn532->setCRC(false);
+    pn532->setLastBits(7);
+    try {
+        pn532->communicateThru(&wupa, 1, response, 2); //ATQA
+    } catch (const PN532::PN532Exception& e) {
+        //Detecting it again below is what counts
     }
+    pn532->setLastBits(0);
+    pn532->setCRC(true);
+    
+    reselect(pn532);
+    pn532->select(tag);
+}
+
+void MIFARE_1K::clone(PN532* pn532, const uint8_t dataIn[0x40][0x10]) {
+    if (!isMagic) throw CodedException(0x0C);
+    
+    std::vector<blockWrite> plan;
+    planWrites(data, dataIn, plan);
+    
+    writePlan(pn532, plan);
 }
 
 void MIFARE_1K::clone(PN532* pn532, const char* filename) {
@@ -322,6 +751,143 @@ void MIFARE_1K::clone(PN532* pn532, const char* filename) {
     return clone(pn532, cloneData);
 }
 
+void MIFARE_1K::planWrites(const uint8_t current[0x40][0x10], const uint8_t target[0x40][0x10], std::vector<blockWrite>& destination) {
+    destination.clear();
+    
+    for (uint8_t i = 1; i <= 0x10; i++) {
+        uint8_t sector = i % 0x10; //1, 2, ... 15, then 0
+        uint8_t trailer = sectorToBlock(sector);
+        
+        //Data first, trailer last
+        for (uint8_t block = trailer - 3; block <= trailer; block++) {
+            if (memcmp(current[block], target[block], 0x10) == 0) continue;
+            
+            blockWrite write;
+            write.block = block;
+            memcpy(write.data, target[block], 0x10);
+            destination.push_back(write);
+        }
+    }
+}
+
+void MIFARE_1K::writePlan(PN532* pn532, const std::vector<blockWrite>& plan, WriteJournal* journal, const uint8_t (*before)[0x10]) {
+    if (plan.empty()) return;
+    
+    //Check everything first, so nothing is sent if the plan can't be carried out
+    bool keysAllowed = true;
+    for (const blockWrite& write : plan) {
+        if (isTrailerBlock(write.block) && !validAccessBits(write.data + 0x06)) throw CodedException(0x19);
+        if (allowedKeys(write.block, true) == KEY_NONE) keysAllowed = false;
+    }
+    if (!isGen1a && !keysAllowed) throw CodedException(0x18);
+    
+    bool backdoor = isGen1a && unlockGen1a(pn532); //No authentication needed at all if this works
+    if (!backdoor && !keysAllowed) throw CodedException(0x18); //Same as chooseKey
+    
+    uint8_t uid[0x04];
+    memcpy(uid, UID, 0x04); //The journal stays under the old UID even if block 0 changes (it can be found by the new one too)
+    
+    if (journal) {
+        if (!before) before = data;
+        
+        std::vector<WriteJournal::entry> entries(plan.size());
+        for (size_t i = 0; i < plan.size(); i++) {
+            entries[i].block = plan[i].block;
+            memcpy(entries[i].before, before[plan[i].block], 0x10);
+            if (isTrailerBlock(plan[i].block)) {
+                //Keys read back from the card are hidden, use the ones known instead
+                uint8_t sector = blockToSector(plan[i].block);
+                getKeyA(sector, &entries[i].before[0x00]);
+                getKeyB(sector, &entries[i].before[0x0A]);
+            }
+            memcpy(entries[i].after, plan[i].data, 0x10);
+            entries[i].done = false;
+        }
+        journal->begin(uid, entries);
+    }
+    
+    for (const blockWrite& write : plan) {
+        if (!backdoor) authenticateFor(pn532, write.block, true); //Only sent once per sector
+        
+        pn532->MifareClassic_WriteBlock(write.block, (uint8_t*)write.data, tag);
+        if (journal) journal->completed(uid, write.block);
+        memcpy(data[write.block], write.data, 0x10);
+        image->clearAltered(write.block);
+        
+        if (isTrailerBlock(write.block)) {
+            syncTrailer(write.block); //The sector's keys have now changed, but this sector won't be authenticated again in this plan
+        } else if (write.block == 0x00) {
+            memcpy(UID, data[0x00], 0x04);
+        }
+    }
+    
+    if (journal) journal->finish(uid);
+}
+
+void MIFARE_1K::syncTrailer(uint8_t block) {
+    uint8_t sector = blockToSector(block);
+    setKeyA(sector, &data[block][0x00]);
+    setAccessBits(sector, &data[block][0x06]);
+    setSpareByte(sector, &data[block][0x09]);
+    setKeyB(sector, &data[block][0x0A]);
+}
+
+bool MIFARE_1K::resumeJournal(PN532* pn532, WriteJournal& journal) {
+    std::vector<WriteJournal::entry> entries;
+    if (!journal.pending(UID, entries)) return false;
+    
+    std::vector<blockWrite> plan;
+    uint8_t before[0x40][0x10];
+    
+    for (const WriteJournal::entry& e : entries) {
+        memcpy(before[e.block], e.before, 0x10);
+        if (e.done) {
+            memcpy(data[e.block], e.after, 0x10); //Already on the card
+            if (isTrailerBlock(e.block)) syncTrailer(e.block); //The keys may have changed
+            continue;
+        }
+        
+        blockWrite write;
+        write.block = e.block;
+        memcpy(write.data, e.after, 0x10);
+        plan.push_back(write);
+    }
+    
+    if (plan.empty()) journal.finish(UID);
+    else writePlan(pn532, plan, &journal, before);
+    
+    return true;
+}
+
+bool MIFARE_1K::rollbackJournal(PN532* pn532, WriteJournal& journal) {
+    std::vector<WriteJournal::entry> entries;
+    if (!journal.pending(UID, entries)) return false;
+    
+    std::vector<blockWrite> plan;
+    uint8_t before[0x40][0x10];
+    
+    for (auto it = entries.rbegin(); it != entries.rend(); it++) {
+        if (!it->done) continue; //Never reached the card
+        
+        memcpy(data[it->block], it->after, 0x10); //What is on the card now
+        memcpy(before[it->block], it->after, 0x10);
+        if (isTrailerBlock(it->block)) syncTrailer(it->block);
+        
+        blockWrite write;
+        write.block = it->block;
+        memcpy(write.data, it->before, 0x10);
+        plan.push_back(write);
+    }
+    
+    //Sector 0 still goes last (as in planWrites), so the UID only changes back once everything else has been authenticated with it
+    std::stable_partition(plan.begin(), plan.end(), [](const blockWrite& write) { return write.block >= 0x04; });
+    
+    if (plan.empty()) journal.finish(UID);
+    else writePlan(pn532, plan, &journal, before);
+    
+    return true;
+}
+
 /*
 *******************************************************************************
 *******************************************************************************
@@ -374,7 +940,7 @@ void MIFARE_1K::dump() {
 
 void MIFARE_1K::flag(uint8_t block) {
     if (!MIFARE_1K::isDataBlock(block)) throw CodedException(0x0B);
-	altered[block] = true;
+	image->flag(block);
 }
 
 /*
@@ -394,7 +960,7 @@ bool MIFARE_1K::isValidSector(uint8_t sector) {
 }
 
 bool MIFARE_1K::isValidBlock(uint8_t block) {
-    return inRange(block, (uint8_t)0x00, (uint8_t)0x40);
+    return inRange(block, (uint8_t)0x00, (uint8_t)0x3F);
 }
 
 bool MIFARE_1K::isTrailerBlock(uint8_t block) {
@@ -405,11 +971,11 @@ bool MIFARE_1K::isDataBlock(uint8_t block) {
 	return (inRange(block, (uint8_t)0x00, (uint8_t)0x3F) && !MIFARE_1K::isTrailerBlock(block));
 }
 
-bool isFirstBlock(uint8_t block) {
+bool MIFARE_1K::isFirstBlock(uint8_t block) {
 	return (block % 4 == 0);
 }
 
-uint8_t blockToSector(uint8_t block) {
+uint8_t MIFARE_1K::blockToSector(uint8_t block) {
 	return (block - (block % 4))/4;
 }
 
@@ -417,7 +983,7 @@ uint8_t MIFARE_1K::sectorToBlock(uint8_t sector) {
 	return (sector * 4 + 3);
 }
 
-uint8_t byteToBlock(uint16_t byte) {
+uint8_t MIFARE_1K::byteToBlock(uint16_t byte) {
 	return byte >> 4;
 }
 
@@ -430,13 +996,10 @@ void MIFARE_1K::MIFAREInfo(PN532* pn532) {
 	for (uint8_t sector = 0; sector < 0x10; sector++) {
 		std::cout << "Attempting to authenticate sector 0x" << std::setw(2) << std::setfill('0') << std::hex << +sector << " with a default key: ";
         
-        try {
-            mifare.authenticate(pn532, sector, true);
-        } catch (const PN532::PN532Exception& e){
-            if (e.code == 0x14) {
-                authenticated[sector] = false;
-            } else throw; // Not authentication error - crash the program
-        }
+        PN532::Status status = mifare.tryAuthenticate(pn532, sector, true);
+        if (status.code == 0x14) {
+            authenticated[sector] = false;
+        } else status.orThrow(); // Not authentication error - crash the program
         
         if (authenticated[sector]) {
             std::cout << "success!";
@@ -449,7 +1012,7 @@ void MIFARE_1K::MIFAREInfo(PN532* pn532) {
 	for (uint8_t sector = 0; sector < 0x10; sector++) {
 		if (authenticated[sector]) {
 			std::cout << "Reading sector 0x" << std::setw(2) << std::setfill('0') << std::hex << +sector << ":";
-            mifare.readSector(pn532, sector, true);
+            mifare.readSector(pn532, sector);
 			std::cout << std::endl;
 		}
 	}
@@ -474,7 +1037,7 @@ void MIFARE_1K::MIFAREInfo(PN532* pn532) {
 	}
 }
 
-void trailerToConditions(uint32_t trailer) {
+void MIFARE_1K::trailerToConditions(uint32_t trailer) {
 	uint8_t byte8 = trailer & 0xff;
 	trailer >>= 0x08;
 	uint8_t byte7 = trailer & 0xff;
@@ -499,7 +1062,7 @@ void trailerToConditions(uint32_t trailer) {
 	}
 }
 
-uint32_t conditionsToTrailer(uint8_t conditions[4]) {
+uint32_t MIFARE_1K::conditionsToTrailer(uint8_t conditions[4]) {
 	uint8_t byte6, byte7, byte8;
 	byte6 = byte7 = byte8 = 0;
 	
@@ -538,6 +1101,9 @@ void MIFARE_1K::loadFromFile(const char *filename, uint8_t startBlock, uint8_t e
     uint16_t nBytes = (startBlock - endBlock + 1) << 4;
     readFile(filename, &data[startBlock][0], nBytes);
     dataToParams(); //Copy in all the keys, UID, etc. to their own variables
-    memset(altered, startBlock, startBlock - endBlock + 1);
+    image->clearAltered();
+    for (uint8_t block = startBlock; block <= endBlock; block++) {
+        if (isDataBlock(block)) image->flag(block);
+    }
 }
 
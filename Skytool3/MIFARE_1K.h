@@ -3,10 +3,14 @@
 
 #include "misc.h"
 #include "PN532.h"
+#include "FigureImage.h"
+#include "WriteJournal.h"
+#include <memory>
 #include <memory.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <fstream>
+#include <vector>
 
 class PN532;
 
@@ -27,6 +31,9 @@ class PN532;
  For example you might have a card where you know the key A for sector 3 is 0x112233445566, so you first call setKeyA(0x112233445566)
  and then you can authenticateA(3) before read and writes.
  
+ The card data itself lives in a FigureImage.  Normally each object owns its own, but an object can also be made as a view of an
+ existing image (e.g. from a FigureArena) so that nothing is copied - see FigureImage.h
+ 
  
  
  
@@ -40,6 +47,44 @@ class PN532;
 class MIFARE_1K {
 public:
     
+    /*
+     Progress of a resumable read (see readResumable).  Keep the same one between calls to carry on where the last call stopped.
+     */
+    struct readProgress {
+        uint64_t done = 0; //Blocks read so far, bit n = block n
+        uint8_t retries[0x40] = {}; //How many times each block had to be retried
+        
+        bool complete(uint64_t blocks) const { return (done & blocks) == blocks; }
+    };
+    
+    /*
+     How hard readResumable tries before giving up.  The wait between attempts doubles each time, up to maxBackoff.
+     */
+    struct retryPolicy {
+        uint8_t maxRetries; //Per block, per call
+        uint16_t initialBackoff; //ms
+        uint16_t maxBackoff; //ms
+        
+        retryPolicy(uint8_t maxRetries = 3, uint16_t initialBackoff = 5, uint16_t maxBackoff = 100) :
+            maxRetries(maxRetries), initialBackoff(initialBackoff), maxBackoff(maxBackoff) {}
+    };
+    
+    /*
+     What was found when verifying writes (see updateSector).  Keep the same one across sectors to get a total.
+     */
+    struct verifyReport {
+        uint64_t mismatched = 0; //Blocks that read back wrong at least once, bit n = block n
+        uint8_t rewrites = 0; //How many extra writes that took
+    };
+    
+    /*
+     A single block write, as part of a write plan (see planWrites)
+     */
+    struct blockWrite {
+        uint8_t block;
+        uint8_t data[0x10];
+    };
+    
     /*
      The default values for a MIFARE 1K chip
      */
@@ -47,12 +92,71 @@ public:
     static constexpr uint8_t defaultKey[0x06] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
     static constexpr uint8_t defaultAccessBits[0x03] = {0xFF, 0x07, 0x80};
     static constexpr uint8_t defaultSpareByte = 0x69;
+    
+    /*
+     Access conditions.  Each block of a sector has three access bits C1 C2 C3 (stored in bytes 6-8 of the sector trailer, once inverted
+     and once not) that say which keys are allowed to do what with it.  These tables are straight from the MIFARE Classic datasheet,
+     indexed by C1C2C3 as a 3 bit number (see accessConditions).
+     
+     The values are masks of which keys are allowed.
+     */
+    static constexpr uint8_t KEY_NONE = 0x00;
+    static constexpr uint8_t KEY_A = 0x01;
+    static constexpr uint8_t KEY_B = 0x02;
+    static constexpr uint8_t KEY_AB = 0x03;
+    
+    struct dataAccess {
+        uint8_t read;
+        uint8_t write;
+    };
+    
+    static constexpr dataAccess dataAccessTable[8] = {
+        {KEY_AB, KEY_AB}, //000 transport configuration
+        {KEY_AB, KEY_NONE}, //001 value block, decrement only
+        {KEY_AB, KEY_NONE}, //010 read only
+        {KEY_B, KEY_B}, //011
+        {KEY_AB, KEY_B}, //100
+        {KEY_B, KEY_NONE}, //101
+        {KEY_AB, KEY_B}, //110 value block
+        {KEY_NONE, KEY_NONE} //111
+    };
+    
+    struct trailerAccess {
+        uint8_t writeKeyA; //Key A can never be read
+        uint8_t readAccessBits;
+        uint8_t writeAccessBits;
+        uint8_t readKeyB;
+        uint8_t writeKeyB;
+    };
+    
+    static constexpr trailerAccess trailerAccessTable[8] = {
+        {KEY_A, KEY_A, KEY_NONE, KEY_A, KEY_A}, //000
+        {KEY_A, KEY_A, KEY_A, KEY_A, KEY_A}, //001 transport configuration
+        {KEY_NONE, KEY_A, KEY_NONE, KEY_A, KEY_NONE}, //010
+        {KEY_B, KEY_AB, KEY_B, KEY_NONE, KEY_B}, //011
+        {KEY_B, KEY_AB, KEY_NONE, KEY_NONE, KEY_B}, //100
+        {KEY_NONE, KEY_AB, KEY_B, KEY_NONE, KEY_NONE}, //101
+        {KEY_NONE, KEY_AB, KEY_NONE, KEY_NONE, KEY_NONE}, //110
+        {KEY_NONE, KEY_AB, KEY_NONE, KEY_NONE, KEY_NONE} //111
+    };
 
     //Constructors
     MIFARE_1K();
     MIFARE_1K(const char* filename);
     MIFARE_1K(const uint8_t dataIn[0x40][0x10]);
     MIFARE_1K(PN532* pn532);
+    MIFARE_1K(const uint8_t uid[0x04], uint8_t tag = 0x01); //For a tag that is already detected, e.g. by a Portal or detectTags - nothing is sent
+    
+    /*
+     Wraps an existing image without copying it - every change is made directly to that image, which must outlive this object.
+     */
+    MIFARE_1K(FigureImage* view);
+    
+    /*
+     Copying an object that owns its image copies the image, copying a view makes another view of the same image.
+     */
+    MIFARE_1K(const MIFARE_1K& other);
+    MIFARE_1K& operator=(const MIFARE_1K& other);
     
     
     //Get/set
@@ -149,40 +253,242 @@ public:
     void getData(uint8_t destination[0x300]);
     void getRawData(uint8_t destination[0x400]);
     
+    FigureImage* getImage();
+    
+    /*
+     getTag/setTag: the PN532's number for this tag (1 unless there are two tags in the field, see PN532::detectTags), used for
+     every command sent to it
+     */
+    uint8_t getTag();
+    void setTag(uint8_t newTag);
+    
     
     //Authentication
+    
+    /*
+     authenticate
+     
+     Authenticates a sector with a specific key (the one stored in keysA/keysB for that sector)
+     */
     void authenticate(PN532* pn532, uint8_t sector, bool keyA);
+    PN532::Status tryAuthenticate(PN532* pn532, uint8_t sector, bool keyA); //Doesn't throw for errors from the tag, see PN532::Status
+    
+    /*
+     authenticateFor
+     
+     Authenticates a block's sector with whichever key the sector's access bits allow for the operation (see chooseKey).
+     
+     block: the block about to be read or written
+     write: true for a write, false for a read
+     
+     returns: true if key A was used, false for key B
+     */
+    bool authenticateFor(PN532* pn532, uint8_t block, bool write);
+    
+    /*
+     chooseKey
+     
+     Picks the key to use to read or write a block, going by the access bits currently known for its sector.  Key A is preferred if
+     both are allowed.  Throws an exception if neither key is allowed, so impossible operations fail before anything is sent to the card.
+     
+     returns: true for key A, false for key B
+     */
+    bool chooseKey(uint8_t block, bool write);
+    
+    /*
+     allowedKeys
+     
+     Which keys (KEY_A, KEY_B, both or none) may read or write a block, going by the access bits currently known for its sector.  If
+     the known access bits aren't valid (e.g. they haven't been read yet) both keys are allowed.
+     
+     For a trailer, writing means writing the access bits, or if nobody may write those, writing at least one of the keys.
+     */
+    uint8_t allowedKeys(uint8_t block, bool write);
+    
+    /*
+     accessConditions
+     
+     Gets the access conditions C1C2C3 of a block (as a 3 bit number, to index the tables above) from a sector's access bits
+     
+     bits: bytes 6-8 of the sector trailer
+     blockInSector: 0-2 for data blocks, 3 for the trailer
+     */
+    static uint8_t accessConditions(const uint8_t bits[0x03], uint8_t blockInSector);
+    
+    /*
+     validAccessBits
+     
+     Checks that the inverted copies of the access bits match.  Writing invalid access bits permanently locks the sector.
+     */
+    static bool validAccessBits(const uint8_t bits[0x03]);
 
-    //Read/write
-    void read(PN532* pn532, bool keyA);
+    //Read/write (the key is chosen automatically for each block, see authenticateFor)
     
-    void readSector(PN532* pn532, uint8_t sector, bool keyA);
+    /*
+     read
+     
+     Reads the whole card, retrying blocks that fail (see readResumable with the default retryPolicy)
+     */
+    void read(PN532* pn532);
     
-    void update(PN532* pn532, bool keyA);
+    /*
+     readResumable
+     
+     Reads blocks, keeping track of which have been read so a failure doesn't lose anything.  When a block fails with an RF error
+     (timeout, CRC, parity, framing, authentication) the tag is reselected and only that block is retried, after a short wait.  If a block
+     still fails after the retries allowed, the error is thrown - everything read so far stays in the image and in progress, so calling
+     again with the same progress (e.g. once the figure is placed again) carries on from the block that failed.
+     
+     Throws an exception if a tag with a different UID turns up when reselecting.
+     
+     blocks: bit mask of blocks to read, bit n = block n
+     progress: which blocks are already done, updated as blocks are read
+     policy: retries and waits
+     */
+    void readResumable(PN532* pn532, uint64_t blocks, readProgress& progress, const retryPolicy& policy = retryPolicy());
+    
+    /*
+     readSector
+     
+     Reads a whole sector.  If the adapter can run MIFARE commands itself (see PN532::supportsMifareMacros) and one key may read every
+     block, that is one round trip instead of five.  read and readResumable do the same for each sector, as do updateSector and the
+     verifying updateSector for their writes and read back.
+     */
+    void readSector(PN532* pn532, uint8_t sector);
+    
+    /*
+     readPair
+     
+     Reads two tags that are in the field together (e.g. the top and bottom of a swapper), going back and forth between them a sector at
+     a time, so both are read in one placement.  Set up each one with its UID and tag number from PN532::detectTags first, e.g.
+     
+        uint8_t uids[2][4], tags[2];
+        if (pn->detectTags(uids, tags) == 2) {
+            Skylander top(uids[0], tags[0]), bottom(uids[1], tags[1]);
+            MIFARE_1K::readPair(pn, top, bottom);
+        }
+     */
+    static void readPair(PN532* pn532, MIFARE_1K& first, MIFARE_1K& second);
+    
+    /*
+     readBlocks
+     
+     Reads only the given blocks, authenticating each sector that has any of them once.  Sector trailers are never read (the keys
+     come back as zeroes anyway), even if they are in the mask.
+     
+     blocks: bit mask of blocks to read, bit n = block n
+     */
+    void readBlocks(PN532* pn532, uint64_t blocks);
+    
+    void update(PN532* pn532);
+    
+    /*
+     update/updateSector (verified)
+     
+     As update/updateSector, but each written block is read back and compared with what should be there.  Any that differ are written again
+     (up to MAX_REWRITES times) and recorded in report.  Throws an exception if a block still doesn't match.
+     
+     The readback is done per sector straight after its writes, so it uses the same authentication and adds one read per written block.
+     */
+    void update(PN532* pn532, verifyReport& report);
+    void updateSector(PN532* pn532, uint8_t sector, verifyReport& report);
+    
+    /*
+     update (journaled)
+     
+     As update, but goes through a write journal (see WriteJournal.h) so that it can be finished or undone if interrupted.  The old
+     contents of each altered block are read first (under the same authentication), since only the new contents are in memory.
+     */
+    void update(PN532* pn532, WriteJournal& journal);
 
-    void updateSector(PN532* pn532, uint8_t sector, bool keyA);
+    void updateSector(PN532* pn532, uint8_t sector);
     
     
     //Security
     void changeKeyA(PN532* pn532, uint8_t sector, uint8_t const newKey[0x06]);
     void changeKeyB(PN532* pn532, uint8_t sector, uint8_t const newKey[0x06]);
 
-    void changeAccessBits(PN532* pn532, uint8_t sector, uint8_t const newBits[0x03], bool keyA);
+    void changeAccessBits(PN532* pn532, uint8_t sector, uint8_t const newBits[0x03]);
     
     
     //Magic functions
-    void changeUID(PN532* pn532, const uint8_t newUID[0x04], bool keyA);
+    void changeUID(PN532* pn532, const uint8_t newUID[0x04]);
     void flagMagic();
-    void changeBlockZero(PN532* pn532, uint8_t const newBlock[0x10], bool keyA);
+    
+    /*
+     detectGen1a
+     
+     Checks whether the card is a gen1a magic card, i.e. one that accepts the 0x40/0x43 "backdoor" unlock sequence.  Those cards can have
+     every block (including block zero and the trailers) written without authenticating, so if this returns true the card is flagged as
+     magic and writePlan (and everything using it - clone, changeBlockZero, changeUID) will use the backdoor.
+     
+     Note the card is halted and left unlocked afterwards, so it is only really useful before writing.
+     
+     returns: whether the card is gen1a
+     */
+    bool detectGen1a(PN532* pn532);
+    void changeBlockZero(PN532* pn532, uint8_t const newBlock[0x10]);
     
     /*
      clone
      
-     Given a magic card, and data to clone, copies the entire contents of the data onto the magic card - including sector trailers, UID
+     Given a magic card, and data to clone, copies the entire contents of the data onto the magic card - including sector trailers, UID.
      
+     Only blocks that differ from this object's data are written (see planWrites), so read the card first if it may not be blank.
+     The card must have been flagged as magic.
      */
     void clone(PN532* pn532, const uint8_t dataIn[0x40][0x10]);
     void clone(PN532* pn532, const char* filename);
+    
+    /*
+     planWrites
+     
+     Works out the fewest block writes needed to turn one card image into another.  Only blocks that differ are written, and each sector
+     trailer (keys, access bits, spare byte) is one combined write.  The plan is ordered so that it can be carried out with one
+     authentication per sector:
+        -Within a sector, data blocks come first and the trailer last, so the old keys/access bits are still in force for the data
+        -Sector 0 comes last, so a new UID in block 0 can't affect authenticating any other sector
+     
+     current: what is on the card now (trailers should contain the real keys, as after read)
+     target: what should be on the card
+     destination: the plan
+     */
+    static void planWrites(const uint8_t current[0x40][0x10], const uint8_t target[0x40][0x10], std::vector<blockWrite>& destination);
+    
+    /*
+     writePlan
+     
+     Carries out a plan from planWrites, authenticating each sector once with the keys currently known for it.  This object's data,
+     keys and UID are updated as each block is written.  The whole plan is checked against the access bits (and any new trailers
+     for valid access bits) before anything is written.
+     
+     On a gen1a card (see detectGen1a) the card is unlocked once and the whole plan is written without any authentication.
+     
+     journal: if given, the plan is recorded there under this card's UID before anything is written, and each block as it is written
+     before: the old contents to record in the journal (defaults to this object's data, i.e. what is believed to be on the card)
+     */
+    void writePlan(PN532* pn532, const std::vector<blockWrite>& plan, WriteJournal* journal = nullptr,
+                   const uint8_t (*before)[0x10] = nullptr);
+    
+    /*
+     resumeJournal
+     
+     If the journal has an unfinished transaction for this card's UID, writes just the blocks that weren't written.  Call after detecting
+     the card again, before anything else is written to it.
+     
+     return value: whether there was anything to resume
+     */
+    bool resumeJournal(PN532* pn532, WriteJournal& journal);
+    
+    /*
+     rollbackJournal
+     
+     If the journal has an unfinished transaction for this card's UID, puts back the old contents of the blocks that were written (newest
+     first, apart from sector 0 which is always last).  The rollback is itself journaled, so it can be resumed if it is interrupted too.
+     
+     return value: whether there was anything to roll back
+     */
+    bool rollbackJournal(PN532* pn532, WriteJournal& journal);
 
 
     //File I/O
@@ -282,6 +588,8 @@ public:
 
 protected:
     bool isMagic;
+    bool isGen1a = false;
+    uint8_t tag = 0x01; //The PN532's number for this tag, see setTag
 
     uint8_t keysA[0x10][0x06];
     uint8_t keysB[0x10][0x06];
@@ -290,14 +598,21 @@ protected:
     
     uint8_t UID[4];
     
-    bool altered[0x40];
-    
-    uint8_t data[0x40][0x10];
+    std::unique_ptr<FigureImage> ownImage; //Only set if this object owns its image
+    FigureImage* image; //The image being worked on, either ownImage or a view of someone else's
+    uint8_t (*data)[0x10]; //Shorthand for image->data
     
     
     //Helpers
     void setDefault();
     
+    /*
+     makeImage
+     
+     Gives this object a new (zeroed) image of its own
+     */
+    void makeImage();
+    
     /*
      paramsToData
      
@@ -321,6 +636,72 @@ protected:
      */
     void calcBCC();
     
+    /*
+     unlockGen1a
+     
+     Halts the card and sends the gen1a unlock sequence (0x40 as 7 bits, then 0x43).  The PN532's CRC/framing settings are restored afterwards.
+     If the card doesn't accept it, it is woken up and selected again (see wakeUp), so it can still be used normally.
+     
+     returns: whether the card accepted it
+     */
+    bool unlockGen1a(PN532* pn532);
+    
+    /*
+     wakeUp
+     
+     Brings a halted card back (WUPA, which unlike REQA is answered by a halted card), then detects and selects it again
+     */
+    void wakeUp(PN532* pn532);
+    
+    /*
+     reselect
+     
+     Detects the tag again after an error (the tag drops out after most errors), and checks it is still the same one.
+     */
+    void reselect(PN532* pn532);
+    
+    /*
+     isRetryable
+     
+     Whether a PN532 error is one that could go away by trying again (i.e. the RF link, rather than something wrong with the request)
+     */
+    static bool isRetryable(uint8_t code);
+    
+    static constexpr uint8_t MAX_REWRITES = 2; //Per block, when verifying
+    
+    /*
+     syncTrailer: sets the keys, access bits and spare byte for a sector from its trailer in data, after the trailer has been written
+     */
+    void syncTrailer(uint8_t block);
+    
+    /*
+     fillTrailer: after a trailer has been read, copies in key A (which reads as zeroes) and takes the access bits and spare byte from it
+     */
+    void fillTrailer(uint8_t block);
+    
+    /*
+     atOnceKey
+     
+     Whether some blocks of a sector can be read or written in one go by the adapter (see PN532::MifareClassic_AuthenticateAndRead) -
+     the adapter has to support it, and one key has to be allowed for all of the blocks.
+     
+     blocks: bit mask of blocks in the sector, bit n = block n of the sector
+     keyA: destination for the key to use (true for key A)
+     */
+    bool atOnceKey(PN532* pn532, uint8_t sector, uint8_t blocks, bool write, bool* keyA);
+    
+    /*
+     tryReadAtOnce/tryWriteAtOnce: reads blocks of a sector into destination (indexed by block in the sector), or writes them from data,
+     in one go (see atOnceKey)
+     */
+    PN532::Status tryReadAtOnce(PN532* pn532, uint8_t sector, uint8_t blocks, bool keyA, uint8_t destination[0x04][0x10]);
+    PN532::Status tryWriteAtOnce(PN532* pn532, uint8_t sector, uint8_t blocks, bool keyA);
+    
+    /*
+     alteredBlocks: bit mask of the data blocks of a sector that have been altered, bit n = block n of the sector
+     */
+    uint8_t alteredBlocks(uint8_t sector);
+    
     
 
 
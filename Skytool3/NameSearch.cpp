@@ -0,0 +1,120 @@
+#include "NameSearch.h"
+#include "toynames.h"
+#include "Hats.h"
+#include <algorithm>
+#include <filesystem>
+
+void NameSearch::trigrams(std::string_view name, std::vector<uint32_t>& destination) {
+    destination.clear();
+    
+    std::string word = " ";
+    auto endWord = [&]() {
+        if (word.length() == 1) return;
+        word += ' ';
+        for (size_t i = 0; i + 2 < word.length(); i++) {
+            destination.push_back(((uint8_t)word[i] << 16) | ((uint8_t)word[i + 1] << 8) | (uint8_t)word[i + 2]);
+        }
+        word = " ";
+    };
+    
+    for (char c : name) {
+        if (isalnum((unsigned char)c)) {
+            word += tolower((unsigned char)c);
+        } else {
+            endWord();
+        }
+    }
+    endWord();
+    
+    std::sort(destination.begin(), destination.end());
+    destination.erase(std::unique(destination.begin(), destination.end()), destination.end());
+}
+
+void NameSearch::add(std::string_view name, uint16_t code) {
+    std::vector<uint32_t> grams;
+    trigrams(name, grams);
+    
+    uint16_t index = entries.size();
+    entries.push_back({std::string(name), code, (uint16_t)grams.size()});
+    
+    for (uint32_t gram : grams) {
+        postings[gram].push_back(index);
+    }
+}
+
+std::vector<NameSearch::match> NameSearch::search(std::string_view query, uint8_t maxResults, scoring method) const {
+    std::vector<match> out;
+    
+    std::vector<uint32_t> grams;
+    trigrams(query, grams);
+    if (grams.empty()) return out;
+    
+    //Count shared trigrams for every entry that has any
+    std::vector<uint16_t> shared(entries.size(), 0);
+    std::vector<uint16_t> candidates;
+    for (uint32_t gram : grams) {
+        auto it = postings.find(gram);
+        if (it == postings.end()) continue;
+        for (uint16_t index : it->second) {
+            if (shared[index]++ == 0) candidates.push_back(index);
+        }
+    }
+    
+    std::vector<float> scores(entries.size(), 0.0f);
+    for (uint16_t index : candidates) {
+        if (method == CONTAINMENT) {
+            scores[index] = (float)shared[index] / entries[index].nTrigrams;
+        } else {
+            scores[index] = 2.0f * shared[index] / (grams.size() + entries[index].nTrigrams);
+        }
+    }
+    
+    size_t n = std::min(candidates.size(), (size_t)maxResults);
+    std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end(), [&](uint16_t a, uint16_t b) {
+        if (scores[a] != scores[b]) return scores[a] > scores[b];
+        if (entries[a].nTrigrams != entries[b].nTrigrams) return entries[a].nTrigrams > entries[b].nTrigrams; //The more specific name
+        return entries[a].code < entries[b].code; //So ties always come out the same way
+    });
+    
+    for (size_t i = 0; i < n; i++) {
+        uint16_t index = candidates[i];
+        out.push_back({entries[index].name, entries[index].code, scores[index]});
+    }
+    
+    return out;
+}
+
+uint16_t NameSearch::bestCode(std::string_view query, float minScore, scoring method) const {
+    std::vector<match> matches = search(query, 1, method);
+    if (matches.empty() || matches[0].score < minScore) return 0xFFFF;
+    return matches[0].code;
+}
+
+const NameSearch& NameSearch::toys() {
+    static const NameSearch index = []() {
+        NameSearch out;
+        if (toyNames.empty()) loadNames();
+        for (const auto& toy : toyNames) {
+            out.add(toy.first, toy.second);
+        }
+        return out;
+    }();
+    return index;
+}
+
+const NameSearch& NameSearch::hats() {
+    static const NameSearch index = []() {
+        NameSearch out;
+        std::vector<uint16_t> codes;
+        getAllHatCodes(codes);
+        for (uint16_t code : codes) {
+            out.add(getHatName(code), code);
+        }
+        return out;
+    }();
+    return index;
+}
+
+uint16_t NameSearch::labelDump(const std::string& filename, float minScore) {
+    return toys().bestCode(std::filesystem::path(filename).stem().string(), minScore, CONTAINMENT);
+}
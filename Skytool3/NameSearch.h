@@ -0,0 +1,108 @@
+#ifndef NAMESEARCH_H_GUARD_
+#define NAMESEARCH_H_GUARD_
+
+/*
+ Fuzzy lookup of character and hat names.
+ 
+ convertCharName and getHatCode only accept exact names, but names typed in (or taken from dump file names) are never quite consistent,
+ e.g. "Chop-Chop", "Chop Chop (Gold)", "Gill grunt".  So this keeps a trigram index of the names, and ranks every name by how many
+ trigrams it shares with the query.
+ 
+ Names are normalised first - lower case, and anything that isn't a letter or number just separates words.  Each word is then padded
+ and split into trigrams, so word order and punctuation don't matter:
+    "Chop-Chop" -> chop chop -> {" ch", "cho", "hop", "op "}
+ 
+ The score is the Dice coefficient of the two trigram sets (1 for a perfect match, 0 for nothing in common), or for CONTAINMENT the
+ fraction of the name's trigrams that are in the query (1 if every word of the name is there).
+ 
+ Usage:
+    uint16_t code = NameSearch::toys().bestCode("Chop-Chop (Legendary)");
+    std::vector<NameSearch::match> matches = NameSearch::hats().search("birthday", 3);
+ */
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+class NameSearch {
+public:
+    struct match {
+        std::string name;
+        uint16_t code;
+        float score;
+    };
+    
+    enum scoring {
+        DICE,       //Shared trigrams against both names - for names typed in, which should be the whole name
+        CONTAINMENT //Fraction of the indexed name found in the query - for names with extra words, e.g. dump file names
+    };
+    
+    static constexpr float DEFAULT_MIN_SCORE = 0.5f;
+    static constexpr float DUMP_MIN_SCORE = 0.75f;
+    
+    /*
+     add: adds a name to the index
+     
+     name: the name as it should be returned
+     code: the code to return with it
+     */
+    void add(std::string_view name, uint16_t code);
+    
+    /*
+     search: ranks the names in the index against a query
+     
+     query: the name to look for
+     maxResults: maximum number of matches to return
+     method: how to score a name against the query
+     
+     return value: the best matches, best first.  Names with no trigrams in common are never returned.  Equal scores go to the name
+        with more trigrams (with CONTAINMENT, "Legendary Chop Chop" over "Chop Chop" if the query has both), then the lower code.
+     */
+    std::vector<match> search(std::string_view query, uint8_t maxResults = 5, scoring method = DICE) const;
+    
+    /*
+     bestCode: the code of the best match for a query
+     
+     query: the name to look for
+     minScore: the lowest score that still counts as a match
+     method: as search
+     
+     return value: the code, or 0xFFFF if nothing scored at least minScore (same as convertCharName/getHatCode)
+     */
+    uint16_t bestCode(std::string_view query, float minScore = DEFAULT_MIN_SCORE, scoring method = DICE) const;
+    
+    /*
+     toys/hats: indexes over the toynames and Hats tables, built the first time they are used
+     */
+    static const NameSearch& toys();
+    static const NameSearch& hats();
+    
+    /*
+     labelDump: guesses the character code of a dump file from its file name, e.g. "dumps/1/Figures/Chop-Chop (Legendary).dump"
+     
+     File names usually add a variant on the end ("Hex (Series 2)", "Eruptor (Lava Barf)"), which pulls the Dice score of the right name
+     down, so this uses CONTAINMENT.
+     
+     return value: the character code, or 0xFFFF if there was no good match
+     */
+    static uint16_t labelDump(const std::string& filename, float minScore = DUMP_MIN_SCORE);
+    
+private:
+    struct entry {
+        std::string name;
+        uint16_t code;
+        uint16_t nTrigrams;
+    };
+    
+    std::vector<entry> entries;
+    std::unordered_map<uint32_t, std::vector<uint16_t>> postings; //Trigram -> indexes of entries containing it
+    
+    /*
+     trigrams: normalises a name and splits it into its set of trigrams (sorted, no duplicates)
+     */
+    static void trigrams(std::string_view name, std::vector<uint32_t>& destination);
+};
+
+#endif
@@ -1,12 +1,32 @@
 #include "PN532.h"
+#include "CommandStats.h"
+#include <thread>
+#include <chrono>
+#include <algorithm>
 
 
-PN532::PN532(Interface* port) : port(port), debug(false) { }
+PN532::PN532(Interface* interface) : ownTransport(new BridgeTransport(interface)), debug(false) {
+    port = ownTransport.get();
+    invalidateAuthentication();
+}
+
+PN532::PN532(Transport* transport) : port(transport), debug(false) {
+    invalidateAuthentication();
+}
 
 void PN532::setDebug(bool d) {
 	debug = d;
 }
 
+void PN532::setStats(CommandStats* s) {
+	stats = s;
+}
+
+void PN532::setReadyPolling(uint32_t intervalMicros, uint32_t deadlineMillis) {
+	readyInterval = intervalMicros;
+	readyDeadline = deadlineMillis;
+}
+
 void PN532::getFirmwareVersion() {
 	frameBuffer[0] = GetFirmwareVersion_CMD;
 	
@@ -29,6 +49,26 @@ void PN532::SAMConfig() {
     std::cout << "SAM was successfully configured." << std::endl;
 }
 
+void PN532::setSerialBaudRate(uint32_t baud) {
+	static const uint32_t rates[8] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+	
+	uint8_t code = 0xFF;
+	for (uint8_t i = 0; i < 8; i++) {
+		if (rates[i] == baud) code = i;
+	}
+	if (code == 0xFF) throw CodedException(0x03);
+	if (!port->hasBaud()) throw CodedException(0x21); //Before the PN532 switches, not after
+	
+	frameBuffer[0] = SetSerialBaudRate_CMD;
+	frameBuffer[1] = code;
+	
+    commandAndResponse(2, 1);
+	
+	abortCommand(); //The PN532 only switches once it gets an ACK for its response
+	std::this_thread::sleep_for(std::chrono::milliseconds(1)); //Let the ACK go out at the old rate
+	port->setBaud(baud);
+}
+
 /*
 
 Description: Sets how long the PN532 will wait for a card response.
@@ -104,6 +144,7 @@ Returns: Success boolean
 */
 
 void PN532::detectMifare1K(uint8_t uid[4]) {
+    invalidateAuthentication();
     
     frameBuffer[0] = InListPassiveTarget_CMD;
     frameBuffer[1] = 0x01; //1 Tag
@@ -123,6 +164,84 @@ void PN532::detectMifare1K(uint8_t uid[4]) {
 
 /*
 
+Description: Detects up to two MIFARE 1K cards in the RF field and saves their UIDs.
+
+Arguments:	uids - destination for the UIDs.
+			tags - destination for the tag numbers.
+
+Returns: Number of cards found
+
+*/
+
+uint8_t PN532::detectTags(uint8_t uids[2][4], uint8_t tags[2]) {
+    invalidateAuthentication();
+    
+    frameBuffer[0] = InListPassiveTarget_CMD;
+    frameBuffer[1] = 0x02; //Up to 2 tags
+    frameBuffer[2] = 0x00; //106 kbps type A
+    
+    commandAndResponse(3, 20); //4B, NbTg, then per tag: Tg, SENS_RES (2), SEL_RES, NFCIDLength, NFCID (4)
+    
+    uint8_t found = frameBuffer[1];
+    if (found > 2) throw CodedException(0x0A);
+    
+    for (uint8_t i = 0; i < found; i++) {
+        const uint8_t* target = frameBuffer + 2 + 9 * i;
+        if (target[4] != 0x04) throw CodedException(0x0A); //Only 4 byte UIDs (MIFARE 1K)
+        
+        tags[i] = target[0];
+        memcpy(uids[i], target + 5, 4);
+    }
+    
+    return found;
+}
+
+/*
+
+Description: Has the PN532 poll for a MIFARE 1K card by itself, and saves its UID if one turns up.
+
+Arguments:	polls - Number of polling cycles
+			period - Time between cycles (units of 150 ms)
+			uid - destination for the UID.
+
+Returns: Whether a card was found
+
+*/
+
+bool PN532::autoPoll(uint8_t polls, uint8_t period, uint8_t uid[4]) {
+    invalidateAuthentication();
+    
+    frameBuffer[0] = InAutoPoll_CMD;
+    frameBuffer[1] = polls;
+    frameBuffer[2] = period;
+    frameBuffer[3] = AUTOPOLL_MIFARE;
+    
+    try {
+        timePoint start = std::chrono::steady_clock::now();
+        writeCommand(4);
+        timePoint acked = std::chrono::steady_clock::now();
+        
+        //The PN532 answers after the first cycle that finds a tag, or after the last cycle
+        waitReady(150 * polls * period + 500, AUTOPOLL_CHECK_MS * 1000, 150000 * period);
+        
+        timePoint ready = std::chrono::steady_clock::now();
+        readData(13); //61, NbTg, Type, Len, Tg, SENS_RES (2), SEL_RES, NFCIDLength, NFCID (4)
+        
+        if (stats) recordTiming(InAutoPoll_CMD << 8, start, acked, ready, std::chrono::steady_clock::now());
+    } catch (...) {
+        invalidateAuthentication();
+        throw;
+    }
+    
+    if (frameBuffer[1] == 0x00) return false;
+    if (frameBuffer[2] != AUTOPOLL_MIFARE || frameBuffer[8] != 0x04) throw CodedException(0x0A); //Not a MIFARE 1K
+    
+    memcpy(uid, frameBuffer + 9, 4);
+    return true;
+}
+
+/*
+
 Description: Selects a target.
 
 Arguments:	Tag number (as defined by PN532)
@@ -132,13 +251,18 @@ Returns: Success boolean
 */
 
 void PN532::select(uint8_t tag) {
+	trySelect(tag).orThrow();
+}
+
+PN532::Status PN532::trySelect(uint8_t tag) {
+	invalidateAuthentication();
 
 	frameBuffer[0] = InSelect_CMD;
 	frameBuffer[1] = tag;
 	
     commandAndResponse(2, 2);
 	
-    decodeError(frameBuffer[1]);
+    return checkError(frameBuffer[1]);
 }
 
 /*
@@ -154,11 +278,23 @@ Returns: Success boolean
 
 */
 
-void PN532::MifareClassic_AuthenticateBlock(uint8_t block, uint8_t uid[4], bool isKeyA, uint8_t key[6]) {
+void PN532::MifareClassic_AuthenticateBlock(uint8_t block, uint8_t uid[4], bool isKeyA, uint8_t key[6], uint8_t tag) {
+	tryMifareClassic_AuthenticateBlock(block, uid, isKeyA, key, tag).orThrow();
+}
+
+PN532::Status PN532::tryMifareClassic_AuthenticateBlock(uint8_t block, uint8_t uid[4], bool isKeyA, uint8_t key[6], uint8_t tag) {
+	uint8_t sector = block / 4;
+	
+	if (session.valid && session.tag == tag && session.sector == sector && session.isKeyA == isKeyA && memcmp(session.key, key, 6) == 0 && memcmp(session.uid, uid, 4) == 0) {
+		if (debug) std::cout << "Sector " << std::dec << +sector << " is already authenticated." << std::endl;
+		return Status();
+	}
+	
+	invalidateAuthentication();
 	
 	//True is for keyA, false is for keyB
 	frameBuffer[0] = InDataExchange_CMD;
-	frameBuffer[1] = 0x01; //Tag Number
+	frameBuffer[1] = tag;
 	frameBuffer[2] = (isKeyA ? 0x60 : 0x61); //Key A or Key B Auth
 	frameBuffer[3] = block;
 	memcpy(frameBuffer + 4, key, 6);
@@ -166,7 +302,82 @@ void PN532::MifareClassic_AuthenticateBlock(uint8_t block, uint8_t uid[4], bool
 	
     commandAndResponse(14, 2);
 	
-    decodeError(frameBuffer[1]);
+    Status status = checkError(frameBuffer[1]);
+    if (!status) return status;
+	
+	session.tag = tag;
+	session.sector = sector;
+	session.isKeyA = isKeyA;
+	memcpy(session.key, key, 6);
+	memcpy(session.uid, uid, 4);
+	session.valid = true;
+	return status;
+}
+
+bool PN532::supportsMifareMacros() {
+	return port->supportsMifareMacros();
+}
+
+PN532::Status PN532::tryMifareClassic_AuthenticateAndRead(const uint8_t* blocks, uint8_t nBlocks, uint8_t uid[4], bool isKeyA, uint8_t key[6],
+                                                          uint8_t (*destination)[0x10], uint8_t tag) {
+	if (nBlocks == 0 || nBlocks > BridgeBatch::MAX_MIFARE_BLOCKS) throw CodedException(0x06);
+	invalidateAuthentication();
+	
+	uint8_t received[BridgeBatch::MAX_MIFARE_BLOCKS][0x10];
+	uint8_t error;
+	try {
+		error = port->mifareRead(tag, isKeyA, key, uid, blocks, nBlocks, received, readyDeadline);
+	} catch (...) {
+		try {
+			abortCommand(); //The adapter may have stopped part way through
+		} catch (...) {}
+		throw;
+	}
+	
+	Status status = finishMacro(error, blocks[0], uid, isKeyA, key, tag);
+	if (status) memcpy(destination, received, nBlocks * 0x10);
+	
+	return status;
+}
+
+PN532::Status PN532::tryMifareClassic_AuthenticateAndWrite(const uint8_t* blocks, uint8_t nBlocks, const uint8_t (*data)[0x10], uint8_t uid[4],
+                                                           bool isKeyA, uint8_t key[6], uint8_t tag) {
+	if (nBlocks == 0 || nBlocks > BridgeBatch::MAX_MIFARE_BLOCKS) throw CodedException(0x06);
+	invalidateAuthentication();
+	
+	uint8_t error;
+	try {
+		error = port->mifareWrite(tag, isKeyA, key, uid, blocks, nBlocks, data, readyDeadline);
+	} catch (...) {
+		try {
+			abortCommand();
+		} catch (...) {}
+		throw;
+	}
+	
+	return finishMacro(error, blocks[0], uid, isKeyA, key, tag);
+}
+
+PN532::Status PN532::finishMacro(uint8_t error, uint8_t block, uint8_t uid[4], bool isKeyA, uint8_t key[6], uint8_t tag) {
+	if (debug) {
+		std::cout << "Sector " << std::dec << +(block / 4) << " done by the adapter, status 0x" << std::hex << std::setfill('0')
+		          << std::setw(2) << +error << std::endl;
+	}
+	
+	Status status = checkError(error);
+	if (!status) return status;
+	
+	session.tag = tag;
+	session.sector = block / 4;
+	session.isKeyA = isKeyA;
+	memcpy(session.key, key, 6);
+	memcpy(session.uid, uid, 4);
+	session.valid = true;
+	return status;
+}
+
+void PN532::invalidateAuthentication() {
+	session.valid = false;
 }
 
 /*
@@ -180,18 +391,23 @@ Returns: Success boolean
 
 */
 
-void PN532::MifareClassic_ReadBlock(uint8_t block, uint8_t* destination) {
+void PN532::MifareClassic_ReadBlock(uint8_t block, uint8_t* destination, uint8_t tag) {
+	tryMifareClassic_ReadBlock(block, destination, tag).orThrow();
+}
+
+PN532::Status PN532::tryMifareClassic_ReadBlock(uint8_t block, uint8_t* destination, uint8_t tag) {
 	
 	frameBuffer[0] = InDataExchange_CMD;
-	frameBuffer[1] = 0x01; //Tag Number
+	frameBuffer[1] = tag;
 	frameBuffer[2] = 0x30; //Mifare read
 	frameBuffer[3] = block;
 	
     commandAndResponse(4, 18);
-		
-	memcpy(destination, frameBuffer + 2, 16);
 	
-    decodeError(frameBuffer[1]);
+    Status status = checkError(frameBuffer[1]);
+	if (status) memcpy(destination, frameBuffer + 2, 16);
+	
+	return status;
 }
 
 /*
@@ -205,10 +421,14 @@ Returns: Success boolean
 
 */
 
-void PN532::MifareClassic_WriteBlock(uint8_t block, uint8_t data[16]) {
+void PN532::MifareClassic_WriteBlock(uint8_t block, uint8_t data[16], uint8_t tag) {
+	tryMifareClassic_WriteBlock(block, data, tag).orThrow();
+}
+
+PN532::Status PN532::tryMifareClassic_WriteBlock(uint8_t block, uint8_t data[16], uint8_t tag) {
 
 	frameBuffer[0] = InDataExchange_CMD;
-	frameBuffer[1] = 0x01;
+	frameBuffer[1] = tag;
 	frameBuffer[2] = 0xA0; //Mifare write
 	frameBuffer[3] = block;
 	
@@ -216,7 +436,75 @@ void PN532::MifareClassic_WriteBlock(uint8_t block, uint8_t data[16]) {
 	
     commandAndResponse(20, 2);
 
-	decodeError(frameBuffer[1]);
+	return checkError(frameBuffer[1]);
+}
+
+uint8_t PN532::readRegister(uint16_t reg) {
+
+	frameBuffer[0] = ReadRegister_CMD;
+	frameBuffer[1] = reg >> 8;
+	frameBuffer[2] = reg & 0xFF;
+	
+    commandAndResponse(3, 2);
+	
+	return frameBuffer[1];
+}
+
+void PN532::writeRegister(uint16_t reg, uint8_t value) {
+
+	frameBuffer[0] = WriteRegister_CMD;
+	frameBuffer[1] = reg >> 8;
+	frameBuffer[2] = reg & 0xFF;
+	frameBuffer[3] = value;
+	
+    commandAndResponse(4, 1);
+}
+
+/*
+
+Description: Sends raw data to the selected target, and reads its raw response.
+
+Arguments:	data - The data to send
+			len - Number of bytes to send
+			destination - Destination for the response
+			responseLen - Number of bytes expected back
+
+*/
+
+void PN532::communicateThru(const uint8_t* data, uint8_t len, uint8_t* destination, uint8_t responseLen) {
+    if (len > PN532_BUFFER_SIZE - 0x10) throw CodedException(0x06);
+	
+	invalidateAuthentication(); //Raw frames (e.g. HALT) can end the tag's authentication
+	
+	frameBuffer[0] = InCommunicateThru_CMD;
+	memcpy(frameBuffer + 1, data, len);
+	
+    commandAndResponse(len + 1, responseLen + 2);
+	
+    decodeError(frameBuffer[1] & 0x3F); //Top two bits are not part of the error code
+	
+	memcpy(destination, frameBuffer + 2, responseLen);
+}
+
+void PN532::setCRC(bool enabled) {
+	uint8_t tx = readRegister(CIU_TxMode);
+	uint8_t rx = readRegister(CIU_RxMode);
+	
+	if (enabled) {
+		setBit(&tx, 7);
+		setBit(&rx, 7);
+	} else {
+		clearBit(&tx, 7);
+		clearBit(&rx, 7);
+	}
+	
+	writeRegister(CIU_TxMode, tx);
+	writeRegister(CIU_RxMode, rx);
+}
+
+void PN532::setLastBits(uint8_t bits) {
+	uint8_t framing = readRegister(CIU_BitFraming);
+	writeRegister(CIU_BitFraming, (framing & 0xF8) | (bits & 0x07));
 }
 
 /*
@@ -267,8 +555,13 @@ Returns: none
 void PN532::checkAck() {
 	static uint8_t ackbuff[7];
 	
-    port->receiveI2C(PN532_I2C, ackbuff, 7);
+	waitReady(readyDeadline, readyInterval);
+    port->readFrame(ackbuff, 7);
 	
+    verifyAck(ackbuff);
+}
+
+void PN532::verifyAck(const uint8_t ackbuff[7]) {
 	if (debug) {
 		if (memcmp(ackbuff + 1, PN532_ACK, 6) == 0) {
 			std::cout << "PN532 acknowledged.\n" << std::endl;
@@ -291,42 +584,55 @@ Returns: Success boolean - If the PN532 ack'd or not
 */
 
 void PN532::writeCommand(uint8_t len) {
+	uint8_t header[6];
+	uint8_t trailer[2];
+	struct iovec segments[3];
+	buildFrame(len, header, trailer, segments);
+	
+    port->writeFrame(segments, 3);
+	
+    checkAck();
+}
 
-	static uint8_t cmdBuffer[64];
+void PN532::buildFrame(uint8_t len, uint8_t header[6], uint8_t trailer[2], struct iovec segments[3]) {
+	if (len > PN532_BUFFER_SIZE) throw CodedException(0x06);
 
-	cmdBuffer[0] = PREAMBLE;
-	cmdBuffer[1] = START1;
-	cmdBuffer[2] = START2;
-	cmdBuffer[3] = len + 1; //TFI to PDn
-	cmdBuffer[4] = ~(cmdBuffer[3]) + 1; //LCS
-	cmdBuffer[5] = 0xD4; //Direction
-	memcpy(cmdBuffer + 6, frameBuffer, len);
+	header[0] = PREAMBLE;
+	header[1] = START1;
+	header[2] = START2;
+	header[3] = len + 1; //TFI to PDn
+	header[4] = ~(header[3]) + 1; //LCS
+	header[5] = 0xD4; //Direction
 	
 	uint8_t dataChecksum = 0xD4;
 
 	for (uint8_t i = 0; i < len; i++) {
-		dataChecksum += cmdBuffer[6 + i];
+		dataChecksum += frameBuffer[i];
 	}
 	
 	dataChecksum = ~dataChecksum;
 	dataChecksum++;
 	
-	cmdBuffer[6 + len] = dataChecksum;
-	cmdBuffer[7 + len] = POSTAMBLE;
+	trailer[0] = dataChecksum;
+	trailer[1] = POSTAMBLE;
 	
 	if (debug) {
 		std::cout << "Sending the following command to PN532: " << std::endl;
 		printHexBytes(frameBuffer, len, -1);
 	}
 	
-    port->sendI2C(PN532_I2C, cmdBuffer, len + 8);
-	
-    checkAck();
+	//Header, the command where it was built, and checksum
+	segments[0].iov_base = header;
+	segments[0].iov_len = 6;
+	segments[1].iov_base = frameBuffer;
+	segments[1].iov_len = len;
+	segments[2].iov_base = trailer;
+	segments[2].iov_len = 2;
 }
 
 /*
 
-Description: Reads a response frame from the PN532 and stores TFI to PDN in the frameBuffer.
+Description: Reads a response frame from the PN532, leaving TFI to PDN in the frameBuffer.  The PN532 must already be ready (see waitReady).
 
 Arguments:	len - The number of bytes to read
 
@@ -335,27 +641,114 @@ Returns: Success boolean
 */
 
 void PN532::readData(uint8_t len) {
-	static uint8_t responseBuffer[64];
+	if (len > PN532_BUFFER_SIZE) throw CodedException(0x06);
 	
-	//Leading 0x01 if ready for I2C!
-    port->receiveI2C(PN532_I2C, responseBuffer, len + 8);
+	//Leading 0x01 if ready for I2C!  Read straight into ioBuffer, so the useful data lands in frameBuffer
+    port->readFrame(ioBuffer, len + 8);
 	
+	parseResponse(len);
+}
+
+void PN532::parseResponse(uint8_t len) {
 	if (debug) {
 		std::cout << "Received this data from the PN532: " << std::endl;
-		printHexBytes(responseBuffer + 7, len, -1);
+		printHexBytes(frameBuffer, len, -1);
 	}
 	
-	if (responseBuffer[6] != 0xD5) {
+	if (ioBuffer[6] != 0xD5) {
 		//If this is not the TFI, then its probably an error
-		decodeError(responseBuffer[6]);
+		decodeError(ioBuffer[6]);
+	}
+}
+
+bool PN532::exchange(uint8_t commandLen, uint8_t responseLen) {
+	if (responseLen > PN532_BUFFER_SIZE) throw CodedException(0x06);
+	
+	uint8_t header[6];
+	uint8_t trailer[2];
+	struct iovec segments[3];
+	uint8_t ackbuff[7];
+	buildFrame(commandLen, header, trailer, segments);
+	
+	try {
+		if (!port->exchange(segments, 3, ackbuff, ioBuffer, responseLen + 8, readyDeadline)) return false;
+	} catch (...) {
+		//The batch may have stopped part way (e.g. a wait ran out), so the PN532 could still be working on the command
+		try {
+			abortCommand();
+		} catch (...) {}
+		throw;
 	}
 	
-	memcpy(frameBuffer, responseBuffer + 7, len); //Copy the actually useful data
+	verifyAck(ackbuff);
+	parseResponse(responseLen);
+	return true;
 }
 
 void PN532::commandAndResponse(uint8_t commandLen, uint8_t responseLen) {
-    writeCommand(commandLen);
-    readData(responseLen);
+    try {
+        if (!stats) {
+            if (exchange(commandLen, responseLen)) return;
+            writeCommand(commandLen);
+            waitReady(readyDeadline, readyInterval);
+            readData(responseLen);
+            return;
+        }
+        
+        uint16_t key = CommandStats::keyOf(frameBuffer, commandLen); //frameBuffer is overwritten by the response
+        timePoint start = std::chrono::steady_clock::now();
+        
+        if (exchange(commandLen, responseLen)) {
+            recordTiming(key, start, start, start, std::chrono::steady_clock::now()); //One round trip, so it can't be split up
+            return;
+        }
+        
+        writeCommand(commandLen);
+        timePoint acked = std::chrono::steady_clock::now();
+        waitReady(readyDeadline, readyInterval);
+        timePoint ready = std::chrono::steady_clock::now();
+        readData(responseLen);
+        timePoint end = std::chrono::steady_clock::now();
+        
+        recordTiming(key, start, acked, ready, end);
+    } catch (...) {
+        invalidateAuthentication(); //No way to know what state the tag is in now
+        throw;
+    }
+}
+
+void PN532::recordTiming(uint16_t key, timePoint start, timePoint acked, timePoint ready, timePoint end) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    
+    stats->record(key, (uint32_t)duration_cast<microseconds>(acked - start).count(),
+                  (uint32_t)duration_cast<microseconds>(ready - acked).count(),
+                  (uint32_t)duration_cast<microseconds>(end - ready).count());
+}
+
+bool PN532::isReady() {
+	return port->isReady();
+}
+
+void PN532::waitReady(uint32_t deadlineMillis, uint32_t intervalMicros, uint32_t maxIntervalMicros) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadlineMillis);
+	
+	while (!isReady()) {
+		if (std::chrono::steady_clock::now() > deadline) {
+			abortCommand();
+			throw CodedException(0x1E);
+		}
+		if (intervalMicros) std::this_thread::sleep_for(std::chrono::microseconds(intervalMicros));
+		if (intervalMicros < maxIntervalMicros) intervalMicros = std::min(intervalMicros * 2, maxIntervalMicros);
+	}
+}
+
+void PN532::abortCommand() {
+	struct iovec segment;
+	segment.iov_base = (void*)PN532_ACK;
+	segment.iov_len = 6;
+	port->writeFrame(&segment, 1);
+	port->discardInput(); //Otherwise a late response would be read as the next ACK
 }
 
 /*
@@ -386,101 +779,106 @@ bool PN532::loadMagicMifare(const char* filename, uint8_t keys[0x10][0x06]) {
  */
 
 void PN532::decodeError(uint8_t error) {
-	if (error == 0x00) return;
+	checkError(error).orThrow();
+}
+
+PN532::Status PN532::checkError(uint8_t error) {
+	if (error == 0x00) return Status();
+    
+    invalidateAuthentication(); //Any error from the tag means it has dropped its authentication
     
-    throw PN532Exception(error);
+    return Status(error);
+}
+
+void PN532::Status::orThrow() const {
+	if (code != 0x00) throw PN532Exception(code);
 }
 
 
 PN532::PN532Exception::PN532Exception(uint8_t code) : code(code) {}
 
 const char * PN532::PN532Exception::what() {
-    std::stringstream stream;
-    stream << std::hex << std::setw(2) << std::setfill('0') << "Error " << code << ": ";
-    
     switch (code) {
         case 0x01:
-            stream << "Time Out, the target has not answered\n";
+            return "Time Out, the target has not answered\n";
             break;
         case 0x02:
-            stream << "A CRC error has been detected by the CIU";
+            return "A CRC error has been detected by the CIU";
             break;
         case 0x03:
-            stream << "A Parity error has been detected by the CIU\n";
+            return "A Parity error has been detected by the CIU\n";
             break;
         case 0x04:
-            stream << "During an anti-collision/select operation (ISO/IEC14443-3 Type A and ISO/IEC18092 106 kbps passive mode), an erroneous Bit Count has been detected\n";
+            return "During an anti-collision/select operation (ISO/IEC14443-3 Type A and ISO/IEC18092 106 kbps passive mode), an erroneous Bit Count has been detected\n";
             break;
         case 0x05:
-            stream << "Framing error during Mifare operation\n";
+            return "Framing error during Mifare operation\n";
             break;
         case 0x06:
-            stream << "An abnormal bit-collision has been detected during bit wise anti-collision at 106 kbps\n";
+            return "An abnormal bit-collision has been detected during bit wise anti-collision at 106 kbps\n";
             break;
         case 0x07:
-            stream << "Communication buffer size insufficient\n";
+            return "Communication buffer size insufficient\n";
             break;
         case 0x09:
-            stream << "RF Buffer overflow has been detected by the CIU (bit BufferOvfl of the register CIU_Error)\n";
+            return "RF Buffer overflow has been detected by the CIU (bit BufferOvfl of the register CIU_Error)\n";
             break;
         case 0x0A:
-            stream << "In active communication mode, the RF field has not been switched on in time by the counterpart (as defined in NFCIP-1 standard)\n";
+            return "In active communication mode, the RF field has not been switched on in time by the counterpart (as defined in NFCIP-1 standard)\n";
             break;
         case 0x0B:
-            stream << "RF Protocol error (cf. Error! Reference source not found., description of the CIU_Error register)\n";
+            return "RF Protocol error (cf. Error! Reference source not found., description of the CIU_Error register)\n";
             break;
         case 0x0D:
-            stream << "Temperature error: the internal temperature sensor has detected overheating, and therefore has automatically switched off the antenna drivers\n";
+            return "Temperature error: the internal temperature sensor has detected overheating, and therefore has automatically switched off the antenna drivers\n";
             break;
         case 0x0E:
-            stream << "Internal buffer overflow\n";
+            return "Internal buffer overflow\n";
             break;
         case 0x10:
-            stream << "Invalid parameter (range, format, ...)\n";
+            return "Invalid parameter (range, format, ...)\n";
             break;
         case 0x12:
-            stream << "DEP Protocol: The PN532 configured in target mode does not support the command received from the initiator (the command received is not one of the following: ATR_REQ, WUP_REQ, PSL_REQ, DEP_REQ, DSL_REQ, RLS_REQ)\n";
+            return "DEP Protocol: The PN532 configured in target mode does not support the command received from the initiator (the command received is not one of the following: ATR_REQ, WUP_REQ, PSL_REQ, DEP_REQ, DSL_REQ, RLS_REQ)\n";
             break;
         case 0x13:
-            stream << "DEP Protocol, Mifare or ISO/IEC14443-4: The data format does not match to the specification.  Depending on the RF protocol used, it can be: Bad length of RF received frame, Incorrect value of PCB or PFB, Invalid or unexpected RF received frame, NAD or DIDincoherence.\n";
+            return "DEP Protocol, Mifare or ISO/IEC14443-4: The data format does not match to the specification.  Depending on the RF protocol used, it can be: Bad length of RF received frame, Incorrect value of PCB or PFB, Invalid or unexpected RF received frame, NAD or DIDincoherence.\n";
             break;
         case 0x14:
-            stream << "MIFARE Authentication error.\n";
+            return "MIFARE Authentication error.\n";
             break;
         case 0x23:
-            stream << "\n";
+            return "ISO/IEC14443-3: UID Check byte is wrong\n";
             break;
         case 0x25:
-            stream << "\n";
+            return "DEP Protocol: Invalid device state, the system is in a state which does not allow the operation\n";
             break;
         case 0x26:
-            stream << "\n";
+            return "Operation not allowed in this configuration (host controller interface)\n";
             break;
         case 0x27:
-            stream << "\n";
+            return "This command is not acceptable due to the current context of the PN532\n";
             break;
         case 0x29:
-            stream << "\n";
+            return "The PN532 configured as target has been released by its initiator\n";
             break;
         case 0x2A:
-            stream << "\n";
+            return "PN532 and ISO/IEC14443-3B only: the ID of the card does not match, meaning that the expected card has been exchanged with another one\n";
             break;
         case 0x2B:
-            stream << "\n";
+            return "PN532 and ISO/IEC14443-3B only: the card previously activated has disappeared\n";
             break;
         case 0x2C:
-            stream << "\n";
+            return "Mismatch between the NFCID3 initiator and the NFCID3 target in DEP 212/424 kbps passive\n";
             break;
         case 0x2D:
-            stream << "\n";
+            return "An over-current event has been detected\n";
             break;
         case 0x2E:
-            stream << "\n";
+            return "NAD missing in DEP frame\n";
             break;
         default:
-            stream << "UNKNOWN";
+            return "Unknown error";
 
     }
-    
-    return stream.str().c_str();
 }
@@ -4,8 +4,13 @@
 #include <stdint.h>
 #include <memory.h>
 #include "Interface.h"
+#include "Transport.h"
+#include <memory>
 #include "misc.h"
 #include <fstream>
+#include <chrono>
+
+class CommandStats;
 
 
 /*
@@ -76,12 +81,37 @@ public:
     static constexpr uint8_t TgResponseToInitiator_CMD = 0x90;
     static constexpr uint8_t TgGetTargetStatus_CMD = 0x8A;
 
+    //CIU registers (for ReadRegister/WriteRegister)
+    static constexpr uint16_t CIU_TxMode = 0x6302; //Bit 7 enables the CRC on transmit
+    static constexpr uint16_t CIU_RxMode = 0x6303; //Bit 7 enables the CRC on receive
+    static constexpr uint16_t CIU_BitFraming = 0x633D; //Bits 0-2 are the number of bits of the last byte to transmit (0 = whole byte)
+
     static constexpr uint8_t PN532_ACK[6] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
     static constexpr uint8_t PN532_NACK[6] = {0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00};
     /*
-     Constructs a PN532 object, to be communicated with over the given port.
+     Status: the result of the non-throwing (try...) functions - zero if the command worked, otherwise the error code the PN532 gave (see
+     PN532Exception).  Timeouts and authentication failures are normal when probing keys or retrying, so these don't go through an
+     exception.  Only errors reported by the PN532 come back like this, a broken link to the PN532 still throws.
+     
+     Each throwing function is just its try... version followed by orThrow.
+     */
+    class Status {
+    public:
+        uint8_t code;
+        
+        constexpr Status(uint8_t code = 0x00) : code(code) {}
+        constexpr bool ok() const { return code == 0x00; }
+        constexpr explicit operator bool() const { return ok(); }
+        
+        void orThrow() const; //Throws a PN532Exception with the code if not ok
+    };
+    
+    /*
+     Constructs a PN532 object, to be communicated with over the given port (through the Arduino bridge), or over any transport (see
+     Transport.h).
      */
     PN532(Interface* port);
+    PN532(Transport* transport);
     /*
 
     setDebug: Toggles debugging messages
@@ -91,6 +121,20 @@ public:
     */
     void setDebug(bool d);
     
+    /*
+     setStats: times every command into the given statistics (see CommandStats.h), or stops timing if null.  Nothing is timed by default.
+     */
+    void setStats(CommandStats* s);
+    
+    /*
+     setReadyPolling: how the PN532's ready status byte is polled before reading an ACK or a response, instead of reading blindly and
+     relying on the serial timeout.  Each read returns as soon as the PN532 is ready.
+     
+     intervalMicros: time between status byte reads (0 to poll back to back)
+     deadlineMillis: how long to wait for the PN532 before giving up (commands that take longer on purpose, like InAutoPoll, use their own)
+     */
+    void setReadyPolling(uint32_t intervalMicros, uint32_t deadlineMillis);
+    
     /*
 
     getFirmwareVersion: Prints the firmware version of the PN532.  Mainly used to check communication.
@@ -102,17 +146,117 @@ public:
      
      */
     void SAMConfig();
+    
+    /*
+     setSerialBaudRate: changes the baud rate of the PN532's HSU link (SetSerialBaudRate), then the host side to match.  Only for an
+     HSUTransport.
+     
+     baud: 9600, 19200, 38400, 57600, 115200, 230400, 460800 or 921600
+     */
+    void setSerialBaudRate(uint32_t baud);
             
     void setMuteTimeout(uint8_t timeout);
     void setCommunicationRetries(uint8_t retries);
     void setPassiveActivationRetries(uint8_t retries);
     
     void detectMifare1K(uint8_t uid[4]);
+    
+    /*
+     detectTags: detects up to two MIFARE 1K tags in the field at once (InListPassiveTarget with MaxTg = 2), e.g. both halves of a
+     Swap Force swapper.  Nothing is printed, and finding no tags is not an error.
+     
+     uids: destination for the UIDs
+     tags: destination for the tag numbers the PN532 gave them, to pass to the MifareClassic functions (see MIFARE_1K::setTag)
+     
+     return value: the number of tags found
+     */
+    uint8_t detectTags(uint8_t uids[2][4], uint8_t tags[2]);
+    
+    /*
+     autoPoll: lets the PN532 look for a MIFARE 1K tag by itself (InAutoPoll), instead of the host asking over and over.  The host only
+     checks the ready status byte until the PN532 answers - after AUTOPOLL_CHECK_MS at first (a tag that is already there is found in the
+     first cycle), then backing off to once per polling period, so a tag placed later is still seen within a period of being found.  A tag
+     that is found is activated as tag 1, just as after detectMifare1K, and nothing is printed.
+     
+     polls: number of polling cycles before giving up (1 - 0xFE)
+     period: time between cycles, in units of 150 ms (1 - 0x0F)
+     uid: destination for the UID of the tag found
+     
+     return value: whether a tag was found
+     */
+    bool autoPoll(uint8_t polls, uint8_t period, uint8_t uid[4]);
+    static constexpr uint8_t AUTOPOLL_MIFARE = 0x10; //Target type for InAutoPoll: passive 106 kbps type A (MIFARE)
+    static constexpr uint8_t AUTOPOLL_CHECK_MS = 20;
+    
+    static constexpr uint32_t DEFAULT_READY_INTERVAL = 200; //us
+    static constexpr uint32_t DEFAULT_READY_DEADLINE = 1000; //ms
+    
     void select(uint8_t tag);
+    Status trySelect(uint8_t tag);
+    
+    /*
+     MifareClassic_AuthenticateBlock: authenticates the sector containing a block.
+     
+     The PN532 object remembers which sector, key and tag it last authenticated successfully, and if that is asked for again the
+     command isn't sent at all.  This is forgotten after any error, and whenever a tag is (re)selected or raw frames are sent, since
+     the tag then drops its authentication.
+     
+     With two tags in the field, tag is the tag number from detectTags.  Only one tag can be authenticated at a time, so switching
+     between tags always authenticates again.
+     */
+    void MifareClassic_AuthenticateBlock(uint8_t block, uint8_t uid[4], bool isKeyA, uint8_t key[6], uint8_t tag = 0x01);
+    Status tryMifareClassic_AuthenticateBlock(uint8_t block, uint8_t uid[4], bool isKeyA, uint8_t key[6], uint8_t tag = 0x01);
     
-    void MifareClassic_AuthenticateBlock(uint8_t block, uint8_t uid[4], bool isKeyA, uint8_t key[6]);
-    void MifareClassic_ReadBlock(uint8_t block, uint8_t* destination);
-    void MifareClassic_WriteBlock(uint8_t block, uint8_t data[16]);
+    /*
+     invalidateAuthentication: forgets the current authentication, so the next MifareClassic_AuthenticateBlock is always sent
+     */
+    void invalidateAuthentication();
+    void MifareClassic_ReadBlock(uint8_t block, uint8_t* destination, uint8_t tag = 0x01);
+    void MifareClassic_WriteBlock(uint8_t block, uint8_t data[16], uint8_t tag = 0x01);
+    Status tryMifareClassic_ReadBlock(uint8_t block, uint8_t* destination, uint8_t tag = 0x01); //destination is untouched on failure
+    Status tryMifareClassic_WriteBlock(uint8_t block, uint8_t data[16], uint8_t tag = 0x01);
+    
+    /*
+     MifareClassic_AuthenticateAndRead/Write: authenticates the sector of the first block and reads or writes a list of blocks in it, all
+     in one round trip, with the adapter running the PN532 commands (see Transport::mifareRead).  Only if supportsMifareMacros, otherwise
+     use MifareClassic_AuthenticateBlock and MifareClassic_ReadBlock/WriteBlock.  Always authenticates, and the sector is remembered as
+     authenticated afterwards, as with MifareClassic_AuthenticateBlock.
+     
+     blocks: the block numbers (up to BridgeBatch::MAX_MIFARE_BLOCKS)
+     destination/data: the blocks' data, in the same order.  destination is untouched on failure.
+     */
+    bool supportsMifareMacros();
+    Status tryMifareClassic_AuthenticateAndRead(const uint8_t* blocks, uint8_t nBlocks, uint8_t uid[4], bool isKeyA, uint8_t key[6],
+                                                uint8_t (*destination)[0x10], uint8_t tag = 0x01);
+    Status tryMifareClassic_AuthenticateAndWrite(const uint8_t* blocks, uint8_t nBlocks, const uint8_t (*data)[0x10], uint8_t uid[4],
+                                                 bool isKeyA, uint8_t key[6], uint8_t tag = 0x01);
+    
+    /*
+     readRegister/writeRegister: read or write one of the PN532's internal registers (e.g. the CIU registers above)
+     */
+    uint8_t readRegister(uint16_t reg);
+    void writeRegister(uint16_t reg, uint8_t value);
+    
+    /*
+     communicateThru: sends raw bytes to the selected tag (InCommunicateThru) and returns its raw response.  Nothing is added or checked
+     apart from what setCRC/setLastBits say, so this can send frames that InDataExchange can't, e.g. the magic card unlock sequence.
+     
+     data: bytes to send
+     len: number of bytes to send
+     destination: destination for the response
+     responseLen: number of bytes expected in the response
+     */
+    void communicateThru(const uint8_t* data, uint8_t len, uint8_t* destination, uint8_t responseLen);
+    
+    /*
+     setCRC: whether the PN532 appends a CRC to frames it sends, and checks/strips it from frames it receives
+     */
+    void setCRC(bool enabled);
+    
+    /*
+     setLastBits: how many bits of the last byte of a frame to send (0 for the whole byte), for short frames like 7 bit commands
+     */
+    void setLastBits(uint8_t bits);
 
     /*
      to revise the location of these
@@ -130,20 +274,81 @@ public:
     public:
         uint8_t code;
         PN532Exception(uint8_t code);
-        const char * what();
+        const char * what(); //Just the description, see code for the number
     };
     
 private:
-    Interface* port;
-    uint8_t frameBuffer[PN532_BUFFER_SIZE];
+    Transport* port;
+    std::unique_ptr<Transport> ownTransport; //When made from an Interface
+    /*
+     Commands are built, and responses parsed, in place in frameBuffer.  It sits 7 bytes into ioBuffer so that a response (ready byte,
+     00 00 FF, LEN, LCS, TFI, data) can be read straight into ioBuffer with the data landing in frameBuffer, and a command frame's header
+     and checksum are sent around it as separate segments (see writeCommand).
+     */
+    uint8_t ioBuffer[PN532_BUFFER_SIZE + 8];
+    uint8_t* const frameBuffer = ioBuffer + 7;
     bool debug;
+    CommandStats* stats = nullptr;
+    uint32_t readyInterval = DEFAULT_READY_INTERVAL; //us
+    uint32_t readyDeadline = DEFAULT_READY_DEADLINE; //ms
+    
+    struct authSession {
+        bool valid;
+        uint8_t tag;
+        uint8_t sector;
+        bool isKeyA;
+        uint8_t key[6];
+        uint8_t uid[4];
+    } session; //The sector that is currently authenticated, see MifareClassic_AuthenticateBlock
     
     void checkAck();
+    void verifyAck(const uint8_t ackbuff[7]);
     void writeCommand(uint8_t len);
+    void buildFrame(uint8_t len, uint8_t header[6], uint8_t trailer[2], struct iovec segments[3]);
     void readData(uint8_t len);
+    void parseResponse(uint8_t len);
+    
+    /*
+     exchange: the whole command in one round trip, if the transport can do that (see Transport::exchange)
+     
+     return value: false if the transport can't, and nothing has been sent
+     */
+    bool exchange(uint8_t commandLen, uint8_t responseLen);
+    
+    /*
+     finishMacro: the status of a MifareClassic_AuthenticateAndRead/Write, remembering the authentication if it worked
+     */
+    Status finishMacro(uint8_t error, uint8_t block, uint8_t uid[4], bool isKeyA, uint8_t key[6], uint8_t tag);
     void decodeError(uint8_t error);
+    Status checkError(uint8_t error); //As decodeError, without throwing
     void commandAndResponse(uint8_t commandLen, uint8_t responseLen);
     
+    /*
+     recordTiming: adds one command's phase times to stats (see CommandStats.h)
+     */
+    typedef std::chrono::steady_clock::time_point timePoint;
+    void recordTiming(uint16_t key, timePoint start, timePoint acked, timePoint ready, timePoint end);
+    
+    /*
+     isReady: reads just the I2C status byte, which is 0x01 once a response is waiting
+     */
+    bool isReady();
+    
+    /*
+     waitReady: polls the status byte every readyInterval until the PN532 is ready.  If it isn't by the deadline, the command is aborted
+     and an exception thrown.
+     
+     deadlineMillis: how long to wait
+     intervalMicros: time between polls
+     maxIntervalMicros: if more than intervalMicros, the time between polls doubles after each one, up to this
+     */
+    void waitReady(uint32_t deadlineMillis, uint32_t intervalMicros, uint32_t maxIntervalMicros = 0);
+    
+    /*
+     abortCommand: sends an ACK frame, which makes the PN532 drop whatever command it is working on
+     */
+    void abortCommand();
+    
     
     
 
@@ -0,0 +1,39 @@
+#include "Portal.h"
+#include <thread>
+#include <chrono>
+
+Portal::Portal(PN532* nfc, Events events, uint8_t period) : nfc(nfc), events(events), period(period) {
+    nfc->SAMConfig();
+}
+
+bool Portal::poll() {
+    uint8_t newUID[0x04];
+    bool found = nfc->autoPoll(POLLS, period, newUID);
+    
+    if (present && (!found || memcmp(newUID, uid, 0x04) != 0)) {
+        present = false;
+        if (events.removed) events.removed(uid);
+    }
+    
+    if (found && !present) {
+        present = true;
+        memcpy(uid, newUID, 0x04);
+        if (events.placed) events.placed(uid);
+    }
+    
+    return present;
+}
+
+void Portal::run(const std::atomic<bool>& stop) {
+    while (!stop) {
+        if (poll()) std::this_thread::sleep_for(std::chrono::milliseconds(150 * period));
+    }
+}
+
+bool Portal::isPresent() const {
+    return present;
+}
+
+void Portal::getUID(uint8_t destination[0x04]) const {
+    memcpy(destination, uid, 0x04);
+}
@@ -0,0 +1,71 @@
+#ifndef PORTAL_H_GUARD_
+#define PORTAL_H_GUARD_
+
+/*
+ Portal mode: the PN532 looks for figures by itself (see PN532::autoPoll) and the host just gets told when a figure is placed or
+ removed, with its UID.
+ 
+ SAMConfig is only sent once, when the portal is made.  Build the figure from the UID in the placed callback rather than with the
+ constructors that detect it again, e.g.
+ 
+    Portal::Events events;
+    events.placed = [&](const uint8_t uid[0x04]) {
+        Skylander sk(uid);
+        sk.read(pn);
+        ...
+    };
+    events.removed = [&](const uint8_t uid[0x04]) { ... };
+ 
+    Portal portal(pn, events);
+    portal.run(stop);
+ 
+ While nothing is on the portal each poll is one InAutoPoll command and about one status byte read per polling period (about 20 for
+ POLLS cycles), instead of a stream of InListPassiveTarget commands.
+ */
+
+#include <stdint.h>
+#include <functional>
+#include <atomic>
+#include "PN532.h"
+
+class Portal {
+public:
+    struct Events {
+        std::function<void(const uint8_t uid[0x04])> placed;
+        std::function<void(const uint8_t uid[0x04])> removed;
+    };
+    
+    static constexpr uint8_t POLLS = 0x10; //Polling cycles per InAutoPoll command, i.e. a few seconds with the default period
+    
+    /*
+     nfc: the reader
+     events: callbacks, either can be empty
+     period: time between polling cycles, in units of 150 ms
+     */
+    Portal(PN532* nfc, Events events, uint8_t period = 0x01);
+    
+    /*
+     poll: sends one InAutoPoll and fires any events.  Returns straight away if a figure is on the portal, otherwise when one is placed
+     or the polling cycles run out.
+     
+     return value: whether a figure is on the portal
+     */
+    bool poll();
+    
+    /*
+     run: polls until stop is set, waiting one period between polls while a figure is on the portal
+     */
+    void run(const std::atomic<bool>& stop);
+    
+    bool isPresent() const;
+    void getUID(uint8_t destination[0x04]) const;
+    
+private:
+    PN532* nfc;
+    Events events;
+    uint8_t period;
+    bool present = false;
+    uint8_t uid[0x04] = {};
+};
+
+#endif
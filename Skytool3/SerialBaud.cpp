@@ -0,0 +1,36 @@
+#include "SerialBaud.h"
+
+#if defined(__linux__)
+
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+
+bool setCustomBaud(int fd, uint32_t baud) {
+    struct termios2 tty;
+    if (ioctl(fd, TCGETS2, &tty) != 0) return false;
+    
+    tty.c_cflag &= ~CBAUD;
+    tty.c_cflag |= BOTHER;
+    tty.c_ispeed = baud;
+    tty.c_ospeed = baud;
+    
+    return ioctl(fd, TCSETS2, &tty) == 0;
+}
+
+#elif defined(__APPLE__)
+
+#include <sys/ioctl.h>
+#include <IOKit/serial/ioss.h>
+
+bool setCustomBaud(int fd, uint32_t baud) {
+    speed_t speed = baud;
+    return ioctl(fd, IOSSIOSPEED, &speed) == 0;
+}
+
+#else
+
+bool setCustomBaud(int fd, uint32_t baud) {
+    return false;
+}
+
+#endif
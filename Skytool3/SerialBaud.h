@@ -0,0 +1,22 @@
+#ifndef SERIALBAUD_H_GUARD_
+#define SERIALBAUD_H_GUARD_
+
+/*
+ Setting serial baud rates that have no B constant (anything past 230400, e.g. 460800 - 2000000).
+ 
+ This is in its own file because on Linux it needs termios2 from <asm/termbits.h>, which can't be included alongside <termios.h>.
+ */
+
+#include <stdint.h>
+
+/*
+ setCustomBaud: sets an arbitrary baud rate on an open, already configured serial port (termios2/BOTHER on Linux, IOSSIOSPEED on macOS)
+ 
+ fd: the port
+ baud: the rate
+ 
+ return value: whether the rate could be set
+ */
+bool setCustomBaud(int fd, uint32_t baud);
+
+#endif
@@ -47,10 +47,16 @@ Skylander::Skylander(const char* filename) : MIFARE_1K(filename) {
 	dataToParams();
 }
 
+Skylander::Skylander(FigureImage* view) : MIFARE_1K(view) {}
+
 Skylander::Skylander(PN532* _nfc) : MIFARE_1K(_nfc) {
 	Encryption::calcKeysA(this);
 }
 
+Skylander::Skylander(const uint8_t uid[0x04], uint8_t tag) : MIFARE_1K(uid, tag) {
+	Encryption::calcKeysA(this);
+}
+
 Skylander::Skylander(PN532* nfc, const char* charName, uint16_t _typeCode) : MIFARE_1K(nfc) {
 	uint8_t key[6];
 	for (uint8_t sector = 0x00; sector < 0x10; sector++) {
@@ -61,12 +67,12 @@ Skylander::Skylander(PN532* nfc, const char* charName, uint16_t _typeCode) : MIF
 	memcpy(newBlockZero + 0x05, sectorZero, 0x0b);
 	memcpy(newBlockZero, &data[0][0], 0x05);
 	flagMagic();
-    changeBlockZero(nfc, newBlockZero, true);
+    changeBlockZero(nfc, newBlockZero);
 	
 	uint16_t _charCode = convertCharName(charName);
                     if (_charCode == 0xFFFF) ;
 	setCharacter(_charCode, _typeCode);
-    update(nfc, true);
+    update(nfc);
 }
 
 
@@ -173,27 +179,23 @@ void Skylander::getLastPlayed(uint8_t destination[0x06]) {
 
 std::string Skylander::getHat() {
     getArea();
-    uint16_t code = 0;
-    int game = 0;
-    for (; game <= 4; game++) {
-        code = getValue(Locations::hats[game], saveArea);
-        if (code > 0) break;
+    for (uint8_t game = 0; game <= 4; game++) {
+        uint8_t value = getValue(Locations::hats[game], saveArea);
+        if (value > 0) return getHatName(storageToHatCode(game, value));
     }
-    if (game == 4) code += 0xFF;
-    return getHatName(code);
+    return getHatName(0);
 }
 
 void Skylander::setHat(std::string hatName) {
     getArea();
     uint16_t code = getHatCode(hatName);
     if (code == 0xFFFF) throw CodedException(0x14);
-    uint8_t game = getHatGame(code);
-    if (game == 4) code -= 0xFF;
+    hatStorage storage = getHatStorage(code);
     
     for (uint8_t i = 0; i <= 4; i++) {
         setValue(Locations::hats[i], saveArea, 0);
     }
-    setValue(Locations::hats[game], saveArea, code);
+    setValue(storage.location, saveArea, storage.value);
 }
 
 
@@ -287,21 +289,190 @@ uint8_t Skylander::areaBlock(uint8_t area) {
 
 
 void Skylander::superchargerFormat(PN532* nfc) {
-	uint8_t newTrailer[0x10];
+	std::vector<blockWrite> plan(0x10);
 	
 	for (uint8_t sector = 0; sector < 0x10; sector++) {
-		uint8_t block = sectorToBlock(sector);
+		plan[sector].block = sectorToBlock(sector);
 		if (sector == 0) {
-			memcpy(newTrailer, zeroTrailer, 0x10);
+			memcpy(plan[sector].data, zeroTrailer, 0x10);
 		} else {
-			memcpy(newTrailer, trailerBytes, 0x10);
+			memcpy(plan[sector].data, trailerBytes, 0x10);
 		}
 		
-		getKeyA(sector, newTrailer);
+		getKeyA(sector, plan[sector].data);
+	}
+	
+	writePlan(nfc, plan); //One authentication per sector, or none on a gen1a card
+}
+
+uint8_t Skylander::readActiveArea(PN532* nfc) {
+    readBlocks(nfc, (1ULL << 0x00) | (1ULL << 0x01) | (1ULL << areaBlock(1)) | (1ULL << areaBlock(2)));
+    return activeAreaFromHeaders();
+}
+
+uint8_t Skylander::activeAreaFromHeaders() {
+    //The data areas are still encrypted, so decrypt copies of the header blocks to compare the counters
+    uint8_t header1[0x10], header2[0x10];
+    Encryption::decryptBlock(this, areaBlock(1) + Locations::save.block, header1);
+    Encryption::decryptBlock(this, areaBlock(2) + Locations::save.block, header2);
+    
+    uint64_t save1 = bytesToInt(header1 + Locations::save.offset, Locations::save.size, true);
+    uint64_t save2 = bytesToInt(header2 + Locations::save.offset, Locations::save.size, true);
+    
+    saveArea = (save2 > save1) ? 2 : 1;
+    return saveArea;
+}
+
+void Skylander::readPlan(PN532* nfc, const ReadPlan& plan) {
+    uint8_t area = readActiveArea(nfc);
+    uint64_t alreadyRead = (1ULL << 0x00) | (1ULL << 0x01) | (1ULL << areaBlock(1)) | (1ULL << areaBlock(2));
+    
+    readBlocks(nfc, plan.blocks(area) & ~alreadyRead);
+}
+
+void Skylander::readProgressive(PN532* nfc, const ProgressCallbacks& callbacks) {
+    Skylander decrypted; //What has been read so far, decrypted, for the callbacks
+    uint64_t have = 0;
+    
+    //Copies newly read blocks into decrypted
+    auto decryptNew = [&](uint64_t blocks) {
+        for (uint8_t block = 0; block < 0x40; block++) {
+            if (!((blocks >> block) & 0x01)) continue;
+            if (Encryption::shouldEncryptBlock(block)) {
+                Encryption::decryptBlock(this, block, decrypted.data[block]);
+            } else {
+                memcpy(decrypted.data[block], data[block], 0x10);
+            }
+        }
+        have |= blocks;
+    };
+    
+    //Identity
+    readBlocks(nfc, 0x03);
+    decryptNew(0x03);
+    if (callbacks.identity) callbacks.identity(getCharCode(), getTypeCode());
+    
+    //Active area
+    uint64_t headers = (1ULL << areaBlock(1)) | (1ULL << areaBlock(2));
+    readBlocks(nfc, headers);
+    uint8_t area = activeAreaFromHeaders();
+    decryptNew(headers);
+    decrypted.saveArea = area;
+    
+    struct group {
+        uint64_t blocks;
+        const std::function<void(Skylander&)>* callback;
+        bool done;
+    };
+    group groups[3] = {
+        {ReadPlan().field(Locations::gold).field(Locations::playtime).fields(Locations::xp, 3).fields(Locations::heroics, 2).blocks(area), &callbacks.stats, false},
+        {ReadPlan().fields(Locations::hats, 5).blocks(area), &callbacks.hat, false},
+        {ReadPlan().fields(Locations::name, 2).blocks(area), &callbacks.name, false}
+    };
+    
+    //Sectors of the active area first, then the rest
+    uint8_t order[0x10];
+    uint8_t nOrder = 0;
+    uint8_t firstSector = blockToSector(areaBlock(area));
+    uint8_t lastSector = blockToSector(areaBlock(area) + 0x0D);
+    for (uint8_t sector = firstSector; sector <= lastSector; sector++) order[nOrder++] = sector;
+    for (uint8_t sector = 0; sector < 0x10; sector++) {
+        if (sector < firstSector || sector > lastSector) order[nOrder++] = sector;
+    }
+    
+    for (uint8_t i = 0; i < 0x10; i++) {
+        uint8_t sector = order[i];
+        uint8_t trailer = sectorToBlock(sector);
+        uint64_t newBlocks = 0;
+        
+        uint8_t missing = (~have >> (trailer - 3)) & 0x0F;
+        bool keyA;
+        if (missing && atOnceKey(nfc, sector, missing, false, &keyA)) {
+            tryReadAtOnce(nfc, sector, missing, keyA, &data[trailer - 3]).orThrow();
+            newBlocks = (uint64_t)missing << (trailer - 3);
+        } else {
+            for (uint8_t block = trailer - 3; block <= trailer; block++) {
+                if ((have >> block) & 0x01) continue;
+                authenticateFor(nfc, block, false);
+                nfc->MifareClassic_ReadBlock(block, data[block], tag);
+                newBlocks |= (1ULL << block);
+            }
+        }
+        getKeyA(sector, data[trailer]); //As in readSector, the key reads as zeroes
+        setAccessBits(sector, &data[trailer][0x06]);
+        decryptNew(newBlocks);
         
+        for (group& g : groups) {
+            if (g.done || (have & g.blocks) != g.blocks) continue;
+            g.done = true;
+            if (*g.callback) (*g.callback)(decrypted);
+        }
+    }
+    
+    if (callbacks.complete) callbacks.complete(decrypted);
+}
 
-        nfc->MifareClassic_WriteBlock(block, newTrailer);
-	}
+bool Skylander::readCached(PN532* nfc, FigureCache& cache) {
+    FigureImage cached;
+    
+    if (cache.lookup(UID, cached)) {
+        uint8_t active = Skylander(&cached).activeAreaFromHeaders();
+        uint8_t headers[2] = {areaBlock(1), areaBlock(2)};
+        
+        readBlocks(nfc, (1ULL << headers[0]) | (1ULL << headers[1]));
+        
+        if (memcmp(data[headers[0]], cached.data[headers[0]], 0x10) == 0 && memcmp(data[headers[1]], cached.data[headers[1]], 0x10) == 0) {
+            memcpy(data, cached.data, 0x400);
+            image->clearAltered();
+            saveArea = active;
+            return true;
+        }
+    }
+    
+    read(nfc);
+    cache.store(*this);
+    return false;
+}
+
+Skylander::ReadPlan& Skylander::ReadPlan::header(const Locations::dataInfo& location) {
+    headerBlocks |= (1ULL << location.block);
+    return *this;
+}
+
+Skylander::ReadPlan& Skylander::ReadPlan::field(const Locations::dataInfo& location) {
+    areaBlocks |= (1ULL << location.block);
+    return *this;
+}
+
+Skylander::ReadPlan& Skylander::ReadPlan::fields(const Locations::dataInfo* locations, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) field(locations[i]);
+    return *this;
+}
+
+Skylander::ReadPlan& Skylander::ReadPlan::wholeArea() {
+    areaBlocks = setBits(0x0E); //Each area is 0x0E blocks (including trailers, which are skipped anyway)
+    return *this;
+}
+
+uint64_t Skylander::ReadPlan::blocks(uint8_t area) const {
+    if (area != 1 && area != 2) throw CodedException(0x16);
+    uint8_t start = (area == 1) ? 0x08 : 0x24;
+    
+    uint64_t out = headerBlocks | (areaBlocks << start);
+    
+    for (uint8_t block = 0x03; block < 0x40; block += 4) {
+        out &= ~(1ULL << block); //No trailers
+    }
+    return out;
+}
+
+Skylander::ReadPlan Skylander::ReadPlan::profile() {
+    ReadPlan plan;
+    plan.header(Locations::charCode).header(Locations::typeCode);
+    plan.field(Locations::gold).field(Locations::playtime).field(Locations::save);
+    plan.fields(Locations::xp, 3).fields(Locations::heroics, 2).fields(Locations::hats, 5);
+    plan.fields(Locations::name, 2).fields(Locations::history, 2);
+    return plan;
 }
 
 void Skylander::loadBackup(const char* filename) {
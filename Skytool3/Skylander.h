@@ -11,17 +11,54 @@
 #include "toynames.h"
 #include "Locations.h"
 #include "Hats.h"
+#include "FigureCache.h"
+#include <functional>
 
 class Skylander : public MIFARE_1K {
 	
 public:
     friend class Encryption;
+    
+    /*
+     ReadPlan: a list of the data a caller actually needs, so that only the blocks holding it are read from the figure (see readPlan).
+     
+     Fields are given as Locations, either in sector zero (header) or in whichever data area is active (field/fields), e.g.
+     
+        Skylander::ReadPlan plan;
+        plan.header(Locations::charCode).field(Locations::gold).fields(Locations::xp, 3);
+        sk->readPlan(pn, plan);
+     */
+    class ReadPlan {
+    public:
+        ReadPlan& header(const Locations::dataInfo& location);
+        ReadPlan& field(const Locations::dataInfo& location);
+        ReadPlan& fields(const Locations::dataInfo* locations, uint8_t n);
+        ReadPlan& wholeArea();
+        
+        /*
+         blocks: the blocks of the card needed by this plan, as a bit mask (bit n = block n)
+         
+         area: the active data area (1 or 2)
+         */
+        uint64_t blocks(uint8_t area) const;
+        
+        /*
+         profile: everything printInfo needs
+         */
+        static ReadPlan profile();
+        
+    private:
+        uint64_t headerBlocks = 0; //Blocks in sector zero
+        uint64_t areaBlocks = 0; //Blocks relative to the start of a data area
+    };
 
     //Constructors
     Skylander();
     Skylander(const char* filename);
     Skylander(PN532* nfc);
+    Skylander(const uint8_t uid[0x04], uint8_t tag = 0x01); //For a figure that is already detected, e.g. by a Portal or PN532::detectTags
     Skylander(PN532* nfc, const char* _charCode, uint16_t _typeCode);
+    Skylander(FigureImage* view); //Works directly on an existing image, see FigureImage.h
     
     //Get/set
     uint16_t getCharCode();
@@ -59,6 +96,53 @@ public:
     
     void superchargerFormat(PN532* nfc);
     
+    /*
+     readActiveArea: reads the first two blocks and the header block of each data area, and works out from the save counters which
+     area is active (1 or 2).  This is all that is needed before a readPlan.
+     */
+    uint8_t readActiveArea(PN532* nfc);
+    
+    /*
+     readPlan: reads only the blocks needed for the plan, from the active data area only, and no sector trailers.  Decrypt as usual afterwards.
+     */
+    void readPlan(PN532* nfc, const ReadPlan& plan);
+    
+    /*
+     ProgressCallbacks: called by readProgressive as soon as each group of data has been read.  Any of them can be left empty.
+     
+     The groups are given a decrypted copy of what has been read so far, so the usual getters (getGold, getHat, getName...) work on it.
+     */
+    struct ProgressCallbacks {
+        std::function<void(uint16_t charCode, uint16_t typeCode)> identity; //After one authentication and two block reads
+        std::function<void(Skylander& decrypted)> stats; //Gold, XP/level, playtime, heroics
+        std::function<void(Skylander& decrypted)> hat;
+        std::function<void(Skylander& decrypted)> name;
+        std::function<void(Skylander& decrypted)> complete; //Every sector has been read
+    };
+    
+    /*
+     readProgressive: reads the whole figure (the same as read), but in an order that gets the useful data first, calling back as it goes:
+        -Blocks 0 and 1 first, for the character/type code
+        -Then the header block of each area, to find the active area
+        -Then the active area, calling each group's callback once all of its blocks are in
+        -Then everything else
+     
+     The image is left encrypted, just like after read.  Everything happens on the calling thread.
+     */
+    void readProgressive(PN532* nfc, const ProgressCallbacks& callbacks);
+    
+    /*
+     readCached: reads the figure, using the cache if it hasn't changed since it was last seen.
+     
+     If the UID is in the cache, only the header blocks of both areas (the blocks holding the save counter, two sectors) are read.  The
+     games save to the inactive area and bump its save counter, but this tool's setters and update change the active area in place,
+     which only shows up in that area's header (its checksums).  If both still match, nothing has been saved since and the cached image
+     is used.  Otherwise (or if the UID is new) the whole figure is read and stored in the cache.
+     
+     return value: whether the cached image was used
+     */
+    bool readCached(PN532* nfc, FigureCache& cache);
+    
     void printInfo();
             
             
@@ -78,6 +162,11 @@ protected:
     uint8_t areaBlock(uint8_t area);
     int getArea();
     
+    /*
+     activeAreaFromHeaders: works out (and sets) the active area from the save counters in the still encrypted header blocks
+     */
+    uint8_t activeAreaFromHeaders();
+    
     uint64_t getValue(Locations::dataInfo location, uint8_t area);
     void setValue(Locations::dataInfo location, uint8_t area, uint64_t val);
     
@@ -0,0 +1,375 @@
+#include "Transport.h"
+#include "exceptions.h"
+#include <memory.h>
+#include <thread>
+#include <chrono>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <linux/i2c-dev.h>
+#include <linux/spi/spidev.h>
+#endif
+
+void Transport::setBaud(uint32_t /*baud*/) {
+    throw CodedException(0x21);
+}
+
+bool Transport::hasBaud() {
+    return false;
+}
+
+void Transport::discardInput() {
+}
+
+bool Transport::exchange(const struct iovec* /*segments*/, int /*nSegments*/, uint8_t* /*ack*/, uint8_t* /*response*/,
+                         uint8_t /*responseLen*/, uint32_t /*timeoutMillis*/) {
+    return false;
+}
+
+bool Transport::supportsMifareMacros() {
+    return false;
+}
+
+uint8_t Transport::mifareRead(uint8_t /*tag*/, bool /*isKeyA*/, const uint8_t /*key*/[6], const uint8_t /*uid*/[4], const uint8_t* /*blocks*/,
+                              uint8_t /*nBlocks*/, uint8_t (* /*destination*/)[0x10], uint32_t /*timeoutMillis*/) {
+    throw CodedException(0x24);
+}
+
+uint8_t Transport::mifareWrite(uint8_t /*tag*/, bool /*isKeyA*/, const uint8_t /*key*/[6], const uint8_t /*uid*/[4], const uint8_t* /*blocks*/,
+                               uint8_t /*nBlocks*/, const uint8_t (* /*data*/)[0x10], uint32_t /*timeoutMillis*/) {
+    throw CodedException(0x24);
+}
+
+/*
+*******************************************************************************
+*******************************************************************************
+BRIDGE*************************************************************************
+*******************************************************************************
+*******************************************************************************
+*/
+
+BridgeTransport::BridgeTransport(Interface* port, uint8_t address) : port(port), address(address) {}
+
+void BridgeTransport::writeFrame(const struct iovec* segments, int nSegments) {
+    port->sendI2C(address, segments, nSegments);
+}
+
+bool BridgeTransport::isReady() {
+    uint8_t status;
+    port->receiveI2C(address, &status, 1);
+    return status & 0x01;
+}
+
+void BridgeTransport::readFrame(uint8_t* destination, uint8_t nBytes) {
+    port->receiveI2C(address, destination, nBytes);
+}
+
+bool BridgeTransport::exchange(const struct iovec* segments, int nSegments, uint8_t* ack, uint8_t* response, uint8_t responseLen,
+                               uint32_t timeoutMillis) {
+    if (!port->supportsBatch()) return false;
+    
+    uint16_t timeout = (uint16_t)std::min<uint32_t>(timeoutMillis, 0xFFFF);
+    
+    BridgeBatch batch;
+    batch.write(address, segments, nSegments)
+         .waitReady(address, timeout).read(address, ack, 7)
+         .waitReady(address, timeout).read(address, response, responseLen);
+    
+    port->runBatch(batch);
+    return true;
+}
+
+bool BridgeTransport::supportsMifareMacros() {
+    return port->getCapabilities() & INTERFACE_CAP_MIFARE;
+}
+
+uint8_t BridgeTransport::mifareRead(uint8_t tag, bool isKeyA, const uint8_t key[6], const uint8_t uid[4], const uint8_t* blocks,
+                                    uint8_t nBlocks, uint8_t (*destination)[0x10], uint32_t timeoutMillis) {
+    if (!supportsMifareMacros()) throw CodedException(0x24);
+    
+    uint8_t status;
+    BridgeBatch batch;
+    batch.mifareRead(address, (uint16_t)std::min<uint32_t>(timeoutMillis, 0xFFFF), tag, isKeyA, key, uid, blocks, nBlocks, &status,
+                     destination);
+    
+    port->runBatch(batch);
+    return status;
+}
+
+uint8_t BridgeTransport::mifareWrite(uint8_t tag, bool isKeyA, const uint8_t key[6], const uint8_t uid[4], const uint8_t* blocks,
+                                     uint8_t nBlocks, const uint8_t (*data)[0x10], uint32_t timeoutMillis) {
+    if (!supportsMifareMacros()) throw CodedException(0x24);
+    
+    uint8_t status;
+    BridgeBatch batch;
+    batch.mifareWrite(address, (uint16_t)std::min<uint32_t>(timeoutMillis, 0xFFFF), tag, isKeyA, key, uid, blocks, nBlocks, data,
+                      &status);
+    
+    port->runBatch(batch);
+    return status;
+}
+
+#ifdef __linux__
+
+//Gathers segments into one buffer, for devices where each write() is a separate transfer
+static size_t gather(const struct iovec* segments, int nSegments, uint8_t* destination, size_t max) {
+    size_t total = 0;
+    for (int i = 0; i < nSegments; i++) {
+        if (total + segments[i].iov_len > max) throw CodedException(0x06);
+        memcpy(destination + total, segments[i].iov_base, segments[i].iov_len);
+        total += segments[i].iov_len;
+    }
+    return total;
+}
+
+/*
+*******************************************************************************
+*******************************************************************************
+I2C-DEV************************************************************************
+*******************************************************************************
+*******************************************************************************
+*/
+
+I2CDevTransport::I2CDevTransport(const std::string& device, uint8_t address) {
+    fd = open(device.c_str(), O_RDWR);
+    if (fd < 0) throw CodedException(0x1F);
+    
+    if (ioctl(fd, I2C_SLAVE, address) < 0) {
+        close(fd);
+        throw CodedException(0x1F);
+    }
+}
+
+I2CDevTransport::~I2CDevTransport() {
+    close(fd);
+}
+
+void I2CDevTransport::writeFrame(const struct iovec* segments, int nSegments) {
+    uint8_t frame[MAX_FRAME];
+    size_t n = gather(segments, nSegments, frame, MAX_FRAME); //writev would be one I2C transaction per segment
+    
+    if (write(fd, frame, n) != (ssize_t)n) throw CodedException(0x20);
+}
+
+bool I2CDevTransport::isReady() {
+    uint8_t status;
+    if (read(fd, &status, 1) != 1) return false; //The PN532 may NACK its address while busy
+    return status & 0x01;
+}
+
+void I2CDevTransport::readFrame(uint8_t* destination, uint8_t nBytes) {
+    if (read(fd, destination, nBytes) != nBytes) throw CodedException(0x20);
+}
+
+/*
+*******************************************************************************
+*******************************************************************************
+SPIDEV*************************************************************************
+*******************************************************************************
+*******************************************************************************
+*/
+
+SPIDevTransport::SPIDevTransport(const std::string& device, uint32_t speed) : speed(speed) {
+    fd = open(device.c_str(), O_RDWR);
+    if (fd < 0) throw CodedException(0x1F);
+    
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8;
+    if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0 || ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+        ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0) {
+        close(fd);
+        throw CodedException(0x1F);
+    }
+}
+
+SPIDevTransport::~SPIDevTransport() {
+    close(fd);
+}
+
+void SPIDevTransport::writeFrame(const struct iovec* segments, int nSegments) {
+    uint8_t frame[MAX_FRAME];
+    frame[0] = SPI_DATA_WRITE;
+    size_t n = gather(segments, nSegments, frame + 1, MAX_FRAME - 1) + 1;
+    
+    transfer(frame, nullptr, n);
+}
+
+bool SPIDevTransport::isReady() {
+    uint8_t tx[2] = {SPI_STATUS_READ, 0x00};
+    uint8_t rx[2];
+    transfer(tx, rx, 2);
+    return rx[1] & 0x01;
+}
+
+void SPIDevTransport::readFrame(uint8_t* destination, uint8_t nBytes) {
+    uint8_t tx[MAX_FRAME] = {SPI_DATA_READ};
+    uint8_t rx[MAX_FRAME];
+    
+    //No status byte over SPI, the frame starts straight after the command byte
+    transfer(tx, rx, nBytes);
+    destination[0] = 0x01;
+    memcpy(destination + 1, rx + 1, nBytes - 1);
+}
+
+void SPIDevTransport::transfer(const uint8_t* tx, uint8_t* rx, size_t nBytes) {
+    uint8_t txReversed[MAX_FRAME];
+    uint8_t rxRaw[MAX_FRAME];
+    if (nBytes > MAX_FRAME) throw CodedException(0x06);
+    
+    for (size_t i = 0; i < nBytes; i++) {
+        txReversed[i] = reverseBits(tx[i]);
+    }
+    
+    struct spi_ioc_transfer message;
+    memset(&message, 0, sizeof(message));
+    message.tx_buf = (unsigned long)txReversed;
+    message.rx_buf = (unsigned long)rxRaw;
+    message.len = nBytes;
+    message.speed_hz = speed;
+    message.bits_per_word = 8;
+    
+    if (ioctl(fd, SPI_IOC_MESSAGE(1), &message) < 0) throw CodedException(0x20);
+    
+    if (rx) {
+        for (size_t i = 0; i < nBytes; i++) {
+            rx[i] = reverseBits(rxRaw[i]);
+        }
+    }
+}
+
+uint8_t SPIDevTransport::reverseBits(uint8_t byte) {
+    byte = (byte & 0xF0) >> 4 | (byte & 0x0F) << 4;
+    byte = (byte & 0xCC) >> 2 | (byte & 0x33) << 2;
+    byte = (byte & 0xAA) >> 1 | (byte & 0x55) << 1;
+    return byte;
+}
+
+/*
+*******************************************************************************
+*******************************************************************************
+HSU****************************************************************************
+*******************************************************************************
+*******************************************************************************
+*/
+
+HSUTransport::HSUTransport(const std::string& device, uint32_t baud) {
+    fd = open(device.c_str(), O_RDWR | O_NOCTTY);
+    if (fd < 0) throw CodedException(0x1F);
+    
+    struct termios tty;
+    if (tcgetattr(fd, &tty) != 0) {
+        close(fd);
+        throw CodedException(0x1F);
+    }
+    
+    cfmakeraw(&tty);
+    tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tty.c_cflag |= CREAD | CLOCAL;
+    tty.c_cc[VTIME] = 10; //Only a backstop, isReady is checked first
+    tty.c_cc[VMIN] = 0;
+    
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        close(fd);
+        throw CodedException(0x1F);
+    }
+    
+    setBaud(baud);
+}
+
+HSUTransport::~HSUTransport() {
+    close(fd);
+}
+
+void HSUTransport::writeFrame(const struct iovec* segments, int nSegments) {
+    static const uint8_t wakeUp[16] = {0x55, 0x55, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    
+    if (nSegments > MAX_SEGMENTS) throw CodedException(0x06);
+    
+    struct iovec all[MAX_SEGMENTS + 1];
+    int n = 0;
+    if (!awake) {
+        all[n].iov_base = (void*)wakeUp;
+        all[n++].iov_len = sizeof(wakeUp);
+    }
+    for (int i = 0; i < nSegments; i++) {
+        all[n++] = segments[i];
+    }
+    
+    size_t total = 0;
+    for (int i = 0; i < n; i++) {
+        total += all[i].iov_len;
+    }
+    
+    if (writev(fd, all, n) != (ssize_t)total) throw CodedException(0x20);
+    awake = true;
+}
+
+bool HSUTransport::isReady() {
+    struct pollfd p = {fd, POLLIN, 0};
+    return poll(&p, 1, 0) > 0 && (p.revents & POLLIN);
+}
+
+void HSUTransport::readFrame(uint8_t* destination, uint8_t nBytes) {
+    //Frames are read whole (using their length), so nothing is left behind to confuse the next read
+    uint8_t frame[MAX_FRAME + 8];
+    readExactly(frame, 5); //00 00 FF LEN LCS
+    
+    size_t frameLen = 5;
+    if ((frame[3] == 0x00 && frame[4] == 0xFF) || (frame[3] == 0xFF && frame[4] == 0x00)) {
+        readExactly(frame + 5, 1); //ACK or NACK, just the postamble left
+        frameLen = 6;
+    } else {
+        readExactly(frame + 5, frame[3] + 2); //TFI to PDn, DCS, postamble
+        frameLen = 5 + frame[3] + 2;
+    }
+    
+    memset(destination, 0, nBytes);
+    destination[0] = 0x01;
+    memcpy(destination + 1, frame, std::min<size_t>(frameLen, nBytes - 1));
+}
+
+void HSUTransport::setBaud(uint32_t baud) {
+    struct termios tty;
+    speed_t speed = convertBaud(baud);
+    
+    if (tcgetattr(fd, &tty) != 0) throw CodedException(0x1F);
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    if (tcsetattr(fd, TCSADRAIN, &tty) != 0) throw CodedException(0x1F);
+}
+
+bool HSUTransport::hasBaud() {
+    return true;
+}
+
+void HSUTransport::discardInput() {
+    tcdrain(fd); //Let the abort go out first
+    std::this_thread::sleep_for(std::chrono::milliseconds(DISCARD_SETTLE_MS)); //A response already on its way still arrives
+    tcflush(fd, TCIFLUSH);
+}
+
+void HSUTransport::readExactly(uint8_t* destination, size_t nBytes) {
+    size_t got = 0;
+    while (got < nBytes) {
+        ssize_t n = read(fd, destination + got, nBytes - got);
+        if (n <= 0) throw CodedException(0x07);
+        got += n;
+    }
+}
+
+speed_t HSUTransport::convertBaud(uint32_t baud) {
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: throw CodedException(0x03);
+    }
+}
+
+#endif
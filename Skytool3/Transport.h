@@ -0,0 +1,193 @@
+#ifndef TRANSPORT_H_GUARD_
+#define TRANSPORT_H_GUARD_
+
+/*
+ The link between the host and the PN532.  PN532 only ever needs to write a frame, check whether the PN532 is ready, and read a
+ frame back, so that is all a transport has to do.
+ 
+ Frames read back always start with a status byte followed by the frame itself (00 00 FF LEN LCS TFI ...), as over I2C.  Transports
+ that have no status byte (SPI, HSU) put 0x01 there, so PN532 can parse every response the same way.
+ 
+ Transports:
+    -BridgeTransport: through the Arduino bridge over a serial port (see Interface.h) - works anywhere
+    -I2CDevTransport: straight to the PN532 over Linux i2c-dev, e.g. /dev/i2c-1
+    -SPIDevTransport: straight to the PN532 over Linux spidev, e.g. /dev/spidev0.0
+    -HSUTransport: straight to the PN532 over its high speed UART, e.g. /dev/ttyS0 (see PN532::setSerialBaudRate)
+ 
+ For example, on a board with the PN532 wired to the I2C pins:
+ 
+    I2CDevTransport link("/dev/i2c-1");
+    PN532* pn = new PN532(&link);
+ */
+
+#include <stdint.h>
+#include <string>
+#include <sys/uio.h>
+#include "Interface.h"
+
+class Transport {
+public:
+    static constexpr uint8_t PN532_I2C_ADDRESS = 0x48 >> 1;
+    static constexpr int MAX_SEGMENTS = Interface::INTERFACE_MAX_SEGMENTS;
+    static constexpr int MAX_FRAME = 0x100;
+    
+    virtual ~Transport() {}
+    
+    /*
+     writeFrame: sends one whole frame to the PN532, given as a list of segments (e.g. header, payload, checksum)
+     */
+    virtual void writeFrame(const struct iovec* segments, int nSegments) = 0;
+    
+    /*
+     isReady: whether the PN532 has something (an ACK or a response) waiting to be read
+     */
+    virtual bool isReady() = 0;
+    
+    /*
+     readFrame: reads a status byte and then the rest of a frame
+     
+     destination: where to put it
+     nBytes: number of bytes including the status byte
+     */
+    virtual void readFrame(uint8_t* destination, uint8_t nBytes) = 0;
+    
+    /*
+     setBaud: changes the host side of the link to a new baud rate (HSU only, see PN532::setSerialBaudRate).  Throws an exception if the
+     transport has no baud rate.
+     */
+    virtual void setBaud(uint32_t baud);
+    virtual bool hasBaud(); //Whether setBaud can be used
+    
+    /*
+     discardInput: throws away anything the PN532 has sent that hasn't been read yet, after a command has been aborted.  Only needed
+     where responses queue up on the host (HSU), the others read from the PN532 itself.
+     */
+    virtual void discardInput();
+    
+    /*
+     exchange: a whole command in one go - writes the frame, waits for and reads the ACK, then waits for and reads the response.
+     Transports that can do this in one round trip (BridgeTransport with an adapter that supports INTERFACE_BATCH) do so and return
+     true, the rest return false without sending anything and PN532 does each step itself.
+     
+     ack: destination for the ACK (7 bytes, status byte first)
+     response: destination for the response (status byte first, as readFrame)
+     responseLen: number of bytes of response including the status byte
+     timeoutMillis: how long to wait for the PN532 each time
+     */
+    virtual bool exchange(const struct iovec* segments, int nSegments, uint8_t* ack, uint8_t* response, uint8_t responseLen,
+                          uint32_t timeoutMillis);
+    
+    /*
+     supportsMifareMacros: whether mifareRead/mifareWrite can be used (BridgeTransport with an adapter that has INTERFACE_CAP_MIFARE)
+     */
+    virtual bool supportsMifareMacros();
+    
+    /*
+     mifareRead/mifareWrite: authenticates once and then reads or writes a list of blocks, all in one round trip, with the PN532
+     commands run by the adapter (see INTERFACE_OP_MIFARE_READ).  Throws an exception if the transport can't.
+     
+     blocks: the block numbers, all in one sector (the first is used to authenticate)
+     destination/data: the blocks' data, in the same order
+     timeoutMillis: how long the adapter waits for the PN532 each time
+     
+     return value: the PN532 status byte of the first command that failed, or 0x00
+     */
+    virtual uint8_t mifareRead(uint8_t tag, bool isKeyA, const uint8_t key[6], const uint8_t uid[4], const uint8_t* blocks, uint8_t nBlocks,
+                               uint8_t (*destination)[0x10], uint32_t timeoutMillis);
+    virtual uint8_t mifareWrite(uint8_t tag, bool isKeyA, const uint8_t key[6], const uint8_t uid[4], const uint8_t* blocks, uint8_t nBlocks,
+                                const uint8_t (*data)[0x10], uint32_t timeoutMillis);
+};
+
+class BridgeTransport : public Transport {
+public:
+    BridgeTransport(Interface* port, uint8_t address = PN532_I2C_ADDRESS);
+    
+    void writeFrame(const struct iovec* segments, int nSegments);
+    bool isReady();
+    void readFrame(uint8_t* destination, uint8_t nBytes);
+    bool exchange(const struct iovec* segments, int nSegments, uint8_t* ack, uint8_t* response, uint8_t responseLen,
+                  uint32_t timeoutMillis);
+    bool supportsMifareMacros();
+    uint8_t mifareRead(uint8_t tag, bool isKeyA, const uint8_t key[6], const uint8_t uid[4], const uint8_t* blocks, uint8_t nBlocks,
+                       uint8_t (*destination)[0x10], uint32_t timeoutMillis);
+    uint8_t mifareWrite(uint8_t tag, bool isKeyA, const uint8_t key[6], const uint8_t uid[4], const uint8_t* blocks, uint8_t nBlocks,
+                        const uint8_t (*data)[0x10], uint32_t timeoutMillis);
+    
+private:
+    Interface* port;
+    uint8_t address;
+};
+
+#ifdef __linux__
+
+class I2CDevTransport : public Transport {
+public:
+    /*
+     device: e.g. "/dev/i2c-1"
+     */
+    I2CDevTransport(const std::string& device, uint8_t address = PN532_I2C_ADDRESS);
+    ~I2CDevTransport();
+    
+    void writeFrame(const struct iovec* segments, int nSegments);
+    bool isReady();
+    void readFrame(uint8_t* destination, uint8_t nBytes);
+    
+private:
+    int fd;
+};
+
+class SPIDevTransport : public Transport {
+public:
+    /*
+     device: e.g. "/dev/spidev0.0"
+     speed: clock in Hz (the PN532 manages up to 5 MHz)
+     */
+    SPIDevTransport(const std::string& device, uint32_t speed = 1000000);
+    ~SPIDevTransport();
+    
+    void writeFrame(const struct iovec* segments, int nSegments);
+    bool isReady();
+    void readFrame(uint8_t* destination, uint8_t nBytes);
+    
+private:
+    int fd;
+    uint32_t speed;
+    
+    //The PN532 talks LSB first, which plenty of SPI controllers can't do, so bytes are reversed here instead
+    static constexpr uint8_t SPI_DATA_WRITE = 0x01;
+    static constexpr uint8_t SPI_STATUS_READ = 0x02;
+    static constexpr uint8_t SPI_DATA_READ = 0x03;
+    
+    void transfer(const uint8_t* tx, uint8_t* rx, size_t nBytes);
+    static uint8_t reverseBits(uint8_t byte);
+};
+
+class HSUTransport : public Transport {
+public:
+    /*
+     device: e.g. "/dev/ttyS0"
+     baud: the PN532 starts at 115200
+     */
+    HSUTransport(const std::string& device, uint32_t baud = 115200);
+    ~HSUTransport();
+    
+    void writeFrame(const struct iovec* segments, int nSegments);
+    bool isReady();
+    void readFrame(uint8_t* destination, uint8_t nBytes);
+    void setBaud(uint32_t baud);
+    bool hasBaud();
+    void discardInput();
+    
+    static constexpr int DISCARD_SETTLE_MS = 5;
+    
+private:
+    int fd;
+    bool awake = false; //The PN532 needs a wake up sequence before the first frame
+    
+    void readExactly(uint8_t* destination, size_t nBytes);
+    static speed_t convertBaud(uint32_t baud);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,229 @@
+#include "WriteJournal.h"
+#include "misc.h"
+#include "exceptions.h"
+#include <fstream>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+
+WriteJournal::WriteJournal(const char* _filename) : filename(_filename) {
+    load();
+}
+
+void WriteJournal::begin(const uint8_t uid[0x04], const std::vector<entry>& entries) {
+    if (entries.size() > 0x40) throw CodedException(0x06);
+    
+    append(RECORD_BEGIN, uid, nullptr, entries.size());
+    for (const entry& e : entries) {
+        append(RECORD_ENTRY, uid, &e, e.block);
+    }
+}
+
+void WriteJournal::completed(const uint8_t uid[0x04], uint8_t block) {
+    append(RECORD_DONE, uid, nullptr, block);
+}
+
+void WriteJournal::finish(const uint8_t uid[0x04]) {
+    append(RECORD_FINISH, uid, nullptr, 0);
+}
+
+bool WriteJournal::pending(const uint8_t uid[0x04], std::vector<entry>& destination) const {
+    uint32_t k = resolve(key(uid));
+    auto it = transactions.find(k);
+    if (it == transactions.end() || !isComplete(k)) return false;
+    
+    destination = it->second;
+    return true;
+}
+
+void WriteJournal::compact() {
+    std::vector<uint8_t> records;
+    uint8_t record[RECORD_SIZE];
+    
+    for (const auto& t : transactions) {
+        if (!isComplete(t.first)) continue;
+        
+        uint8_t uid[0x04];
+        intToBytes((uint64_t)t.first, 0x04, uid, false);
+        
+        encode(RECORD_BEGIN, uid, nullptr, t.second.size(), record);
+        records.insert(records.end(), record, record + RECORD_SIZE);
+        for (const entry& e : t.second) {
+            encode(RECORD_ENTRY, uid, &e, e.block, record);
+            records.insert(records.end(), record, record + RECORD_SIZE);
+        }
+        for (const entry& e : t.second) {
+            if (!e.done) continue;
+            encode(RECORD_DONE, uid, nullptr, e.block, record);
+            records.insert(records.end(), record, record + RECORD_SIZE);
+        }
+    }
+    
+    //Written to a new file which replaces the old one, so a crash part way leaves the old journal
+    std::string temporary = filename + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw CodedException(0x1B);
+    try {
+        writeRecords(fd, records.data(), records.size());
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    
+    if (rename(temporary.c_str(), filename.c_str()) != 0) throw CodedException(0x1B);
+    directorySynced = false;
+    syncDirectory();
+}
+
+/*
+*******************************************************************************
+*******************************************************************************
+HELPERS************************************************************************
+*******************************************************************************
+*******************************************************************************
+*/
+
+void WriteJournal::load() {
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file) return; //Nothing journaled yet
+    
+    uint8_t record[RECORD_SIZE];
+    while (file.read(reinterpret_cast<char*>(record), RECORD_SIZE)) {
+        entry e;
+        e.block = record[0x05];
+        memcpy(e.before, record + 0x06, 0x10);
+        memcpy(e.after, record + 0x16, 0x10);
+        e.done = false;
+        
+        apply(record[0x00], key(record + 0x01), e);
+    }
+    
+    //Crashed during begin - nothing was sent to the card for these
+    for (auto it = transactions.begin(); it != transactions.end();) {
+        if (isComplete(it->first)) {
+            it++;
+        } else {
+            expected.erase(it->first);
+            it = transactions.erase(it);
+        }
+    }
+}
+
+void WriteJournal::append(uint8_t type, const uint8_t uid[0x04], const entry* e, uint8_t block) {
+    uint8_t record[RECORD_SIZE];
+    encode(type, uid, e, block, record);
+    
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) throw CodedException(0x1B);
+    try {
+        writeRecords(fd, record, RECORD_SIZE); //Must be on disk before the block is sent
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    syncDirectory(); //In case the file was just created
+    
+    entry copy = {};
+    copy.block = block;
+    if (e) copy = *e;
+    copy.done = false;
+    apply(type, key(uid), copy);
+}
+
+void WriteJournal::apply(uint8_t type, uint32_t k, const entry& e) {
+    switch (type) {
+        case RECORD_BEGIN:
+            //Replaces whatever this UID would have found, including a transaction under the card's other UID
+            for (uint32_t old = resolve(k); transactions.erase(old); old = resolve(k)) {
+                expected.erase(old);
+            }
+            transactions[k].clear();
+            expected[k] = e.block;
+            break;
+        case RECORD_ENTRY:
+            transactions[k].push_back(e);
+            break;
+        case RECORD_DONE: {
+            auto it = transactions.find(resolve(k));
+            if (it == transactions.end()) break;
+            for (entry& pendingEntry : it->second) {
+                if (pendingEntry.block == e.block) pendingEntry.done = true;
+            }
+            break;
+        }
+        case RECORD_FINISH: {
+            uint32_t found = resolve(k);
+            transactions.erase(found);
+            expected.erase(found);
+            break;
+        }
+        default:
+            break; //Unknown record, skip it
+    }
+}
+
+uint32_t WriteJournal::key(const uint8_t uid[0x04]) {
+    return bytesToInt((uint8_t*)uid, 0x04, false);
+}
+
+uint32_t WriteJournal::resolve(uint32_t k) const {
+    if (transactions.count(k)) return k;
+    
+    for (const auto& t : transactions) {
+        for (const entry& e : t.second) {
+            if (e.block == 0x00 && (key(e.before) == k || key(e.after) == k)) return t.first;
+        }
+    }
+    
+    return k;
+}
+
+bool WriteJournal::isComplete(uint32_t k) const {
+    auto count = expected.find(k);
+    auto it = transactions.find(k);
+    return count != expected.end() && it != transactions.end() && it->second.size() == count->second;
+}
+
+void WriteJournal::encode(uint8_t type, const uint8_t uid[0x04], const entry* e, uint8_t block, uint8_t record[RECORD_SIZE]) {
+    memset(record, 0, RECORD_SIZE);
+    record[0x00] = type;
+    memcpy(record + 0x01, uid, 0x04);
+    record[0x05] = block;
+    if (e) {
+        memcpy(record + 0x06, e->before, 0x10);
+        memcpy(record + 0x16, e->after, 0x10);
+    }
+}
+
+void WriteJournal::writeRecords(int fd, const uint8_t* records, size_t nBytes) {
+    while (nBytes > 0) {
+        ssize_t written = write(fd, records, nBytes);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw CodedException(0x1B);
+        }
+        records += written;
+        nBytes -= written;
+    }
+    
+    if (fsync(fd) != 0) throw CodedException(0x1B);
+}
+
+void WriteJournal::syncDirectory() {
+    if (directorySynced) return;
+    
+    size_t slash = filename.find_last_of('/');
+    std::string directory = (slash == std::string::npos) ? "." : filename.substr(0, slash + 1);
+    
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd < 0) throw CodedException(0x1B);
+    int result = fsync(fd);
+    close(fd);
+    if (result != 0) throw CodedException(0x1B);
+    
+    directorySynced = true;
+}
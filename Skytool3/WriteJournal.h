@@ -0,0 +1,100 @@
+#ifndef WRITEJOURNAL_H_GUARD_
+#define WRITEJOURNAL_H_GUARD_
+
+/*
+ An append-only journal of block writes, kept on the host and keyed by UID, so that a write interrupted by the figure being lifted
+ can be finished (or undone) the next time the same figure is placed.
+ 
+ Each planned write is recorded with both the old and the new contents of the block before anything is sent, then each block is
+ marked done as its write is acknowledged, and the whole transaction is marked finished at the end.  Anything not finished is
+ pending, see MIFARE_1K::resumeJournal and MIFARE_1K::rollbackJournal.
+ 
+ Having the old contents matters most for Skylanders, where a half written data area is neither the old save nor the new one - it
+ has to be either finished or put back.
+ 
+ The file is a list of fixed size records, each synced to disk (fsync) before the call returns.  A record cut short (e.g. by a crash
+ mid-write) is ignored when loading, and so is a transaction whose entries didn't all make it (the begin record carries the count).
+ Use compact now and then to drop finished transactions from the file.
+ 
+ A transaction that writes block 0 can change the UID part way through, so it can also be found (and marked done or finished) by the
+ old or new UID in its block 0 entry, whichever the card has now.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+class WriteJournal {
+public:
+    struct entry {
+        uint8_t block;
+        uint8_t before[0x10];
+        uint8_t after[0x10];
+        bool done;
+    };
+    
+    /*
+     filename: the journal file, created if it doesn't exist.  Any pending transactions in it are loaded.
+     */
+    WriteJournal(const char* filename);
+    
+    /*
+     begin: records a new transaction for a UID (replacing any pending one it can be found by), before anything is written
+     */
+    void begin(const uint8_t uid[0x04], const std::vector<entry>& entries);
+    
+    /*
+     completed: records that a block of the UID's transaction has been written
+     */
+    void completed(const uint8_t uid[0x04], uint8_t block);
+    
+    /*
+     finish: records that the UID's transaction is over (all written, or given up on)
+     */
+    void finish(const uint8_t uid[0x04]);
+    
+    /*
+     pending: gets the UID's unfinished transaction, if there is one
+     
+     destination: every entry of the transaction, in the original order, with done set for those written
+     
+     return value: whether there was one
+     */
+    bool pending(const uint8_t uid[0x04], std::vector<entry>& destination) const;
+    
+    /*
+     compact: rewrites the file with only the pending transactions
+     */
+    void compact();
+    
+private:
+    std::string filename;
+    std::unordered_map<uint32_t, std::vector<entry>> transactions;
+    std::unordered_map<uint32_t, uint8_t> expected; //Number of entries each transaction's begin record says it has
+    bool directorySynced = false;
+    
+    static constexpr uint8_t RECORD_BEGIN = 'B';
+    static constexpr uint8_t RECORD_ENTRY = 'W';
+    static constexpr uint8_t RECORD_DONE = 'D';
+    static constexpr uint8_t RECORD_FINISH = 'F';
+    static constexpr size_t RECORD_SIZE = 0x26; //type, UID, block (entry count for a begin record), before, after
+    
+    void load();
+    void append(uint8_t type, const uint8_t uid[0x04], const entry* e, uint8_t block);
+    void apply(uint8_t type, uint32_t key, const entry& e);
+    static uint32_t key(const uint8_t uid[0x04]);
+    
+    /*
+     resolve: the key of the transaction a UID refers to - its own, or one whose block 0 entry has it as the old or new UID.  Returns
+     the UID's own key if there is neither.
+     */
+    uint32_t resolve(uint32_t k) const;
+    bool isComplete(uint32_t k) const;
+    
+    static void encode(uint8_t type, const uint8_t uid[0x04], const entry* e, uint8_t block, uint8_t record[RECORD_SIZE]);
+    static void writeRecords(int fd, const uint8_t* records, size_t nBytes); //Then fsyncs
+    void syncDirectory();
+};
+
+#endif
@@ -10,6 +10,10 @@
 
 CodedException::CodedException(uint16_t code) : code(code) {}
 
+uint16_t CodedException::getCode() const {
+    return code;
+}
+
 const char * CodedException::what() {
     switch (code) {
         case 0x01:
@@ -78,6 +82,48 @@ const char * CodedException::what() {
         case 0x16:
             return "The requested area is not a valid data area on a skylander.";
             break;
+        case 0x17:
+            return "The figure arena is full.";
+            break;
+        case 0x18:
+            return "The sector's access bits do not allow this operation with either key.";
+            break;
+        case 0x19:
+            return "Invalid access bits (writing them would permanently lock the sector).";
+            break;
+        case 0x1A:
+            return "A different tag was found when reselecting.";
+            break;
+        case 0x1B:
+            return "Could not write to the write journal.";
+            break;
+        case 0x1C:
+            return "A block still did not match after being written again.";
+            break;
+        case 0x1D:
+            return "Error writing to the serial port.";
+            break;
+        case 0x1E:
+            return "The PN532 did not become ready in time.";
+            break;
+        case 0x1F:
+            return "Could not open or configure the transport device.";
+            break;
+        case 0x20:
+            return "A transfer on the transport device failed.";
+            break;
+        case 0x21:
+            return "This transport does not have a baud rate.";
+            break;
+        case 0x22:
+            return "Lost the link to the interface adapter while changing baud rate.";
+            break;
+        case 0x23:
+            return "The interface adapter could not finish a batch.";
+            break;
+        case 0x24:
+            return "This transport can not run MIFARE commands by itself.";
+            break;
         default:
             return "unknown error code";
     }
@@ -9,6 +9,7 @@
 #define EXCEPTIONS_H_GUARD
 
 #include <exception>
+#include <stdint.h>
 
 class CodedException: public std::exception
 {
@@ -18,6 +19,7 @@ private:
 public:
     CodedException(uint16_t code);
     const char * what();
+    uint16_t getCode() const;
 };
 
 #endif /* exceptions_hpp */
@@ -29,7 +29,7 @@ int main() {
     Skylander* sk = new Skylander(pn);
     
     
-    sk->read(pn, true);
+    sk->read(pn);
     Encryption::decrypt(sk);
     sk->printInfo();
     sk->dump();
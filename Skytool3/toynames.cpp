@@ -1,5 +1,5 @@
 #include "toynames.h"
-using std::string, std::map;
+using std::string, std::map, std::pair;
 
 map <string, uint16_t> toyNames;
 
@@ -21,6 +21,8 @@
 #include <map>
 #include <string>
 
+extern std::map<std::string, uint16_t> toyNames; //Name -> character code, filled by loadNames
+
 void loadNames();
 void fillCodes(uint16_t* startPtr, uint16_t val, uint16_t n);
 uint16_t convertCharName(const char* name);